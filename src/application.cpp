@@ -35,9 +35,9 @@ namespace Horizon {
 			model = Gtk::ListStore::create(thread_summary_columns);
 			summary_view = Gtk::manage(new Gtk::TreeView());
 			summary_view->set_model(model);
-			SummaryCellRenderer *cr = Gtk::manage(new SummaryCellRenderer());
-			Gtk::TreeViewColumn *column = Gtk::manage(new Gtk::TreeViewColumn("Threads", *cr));
-			column->add_attribute(cr->property_threads(), thread_summary_columns.thread_summary);
+			summary_renderer = Gtk::manage(new SummaryCellRenderer());
+			Gtk::TreeViewColumn *column = Gtk::manage(new Gtk::TreeViewColumn("Threads", *summary_renderer));
+			column->add_attribute(summary_renderer->property_threads(), thread_summary_columns.thread_summary);
 			column->set_sort_column(thread_summary_columns.ppm);
 			column->set_sort_order(Gtk::SORT_DESCENDING);
 			column->set_sort_indicator(true);
@@ -50,6 +50,9 @@ namespace Horizon {
 
 			summary_view->append_column(*column);
 			sw->add(*summary_view);
+			auto catalog_adjustment = sw->get_vadjustment();
+			catalog_adjustment->signal_value_changed().connect(sigc::mem_fun(*this, &Application::queue_catalog_prioritize));
+			catalog_adjustment->signal_changed().connect(sigc::mem_fun(*this, &Application::queue_catalog_prioritize));
 			summary_view->signal_button_press_event().connect(sigc::mem_fun(*this, &Application::on_treeview_click), false);
 			board_combobox->signal_changed().connect(sigc::mem_fun(*this, &Application::on_catalog_board_change));
 			summary_grid->attach(*search_entry, 0, 0, 1, 1);
@@ -102,7 +105,7 @@ namespace Horizon {
 		manager.signal_thread_updated.connect(sigc::mem_fun(*this, &Application::onUpdates));
 		manager.signal_catalog_updated.connect(sigc::mem_fun(*this, &Application::on_catalog_update));
 
-		catalog_image_fetcher = std::make_shared<ImageFetcher>(image_cache);
+		catalog_image_fetcher = std::make_shared<ImageFetcher>(image_cache, pixbuf_cache);
 
 		auto schemas = Gio::Settings::list_schemas();
 		auto iter = std::find(schemas.begin(),
@@ -117,6 +120,11 @@ namespace Horizon {
 			std::cerr << "Error: GSettings schema not found. No actions in this session will be remembered. Did you 'make install'?" << std::endl;
 		}
 
+		if (settings) {
+			apply_cache_quotas();
+			settings->signal_changed().connect(sigc::mem_fun(*this, &Application::on_settings_changed));
+		}
+
 		board_combobox = Gtk::manage(new Gtk::ComboBoxText());
 		setup_actions();
 		setup_window();
@@ -136,6 +144,26 @@ namespace Horizon {
 
 		manager_alarm = Glib::signal_timeout().connect_seconds(sigc::mem_fun(&manager, &Manager::update_threads), 3);
 		summary_alarm = Glib::signal_timeout().connect_seconds(sigc::mem_fun(&manager, &Manager::update_catalogs), 60);
+		tab_ticker = Glib::signal_timeout().connect_seconds(sigc::mem_fun(*this, &Application::on_tab_tick), 10);
+	}
+
+	bool Application::on_tab_tick() {
+		for (auto pair : thread_map)
+			pair.second->on_tab_tick();
+
+		return true;
+	}
+
+	void Application::on_settings_changed(const Glib::ustring &key) {
+		if (key.find("cache-") == 0)
+			apply_cache_quotas();
+	}
+
+	void Application::apply_cache_quotas() {
+		constexpr guint64 MiB = 1024 * 1024;
+		image_cache->set_quotas(settings->get_uint("cache-thumbnail-quota") * MiB,
+		                        settings->get_uint("cache-image-quota") * MiB,
+		                        settings->get_uint("cache-catalog-quota") * MiB);
 	}
 
 	void Application::setup_actions() {
@@ -246,7 +274,7 @@ namespace Horizon {
 
 				auto sp_ifetcher = chan_image_fetcher.lock();
 				if (!sp_ifetcher) {
-					sp_ifetcher = std::make_shared<ImageFetcher>(image_cache);
+					sp_ifetcher = std::make_shared<ImageFetcher>(image_cache, pixbuf_cache);
 					chan_image_fetcher = sp_ifetcher;
 				}
 
@@ -414,6 +442,7 @@ namespace Horizon {
 
 	void Application::on_catalog_board_change() {
 		model->clear();
+		summary_renderer->clear_layout_cache();
 		refresh_catalog_view();
 	}
 
@@ -498,12 +527,7 @@ namespace Horizon {
 					                             thread->get_reply_count());
 					row.set_value(thread_summary_columns.image_count,
 					                             thread->get_image_count());
-					auto ppm = static_cast<float>(thread->get_reply_count()) /
-						static_cast<float>(Glib::DateTime::
-						                   create_now_utc().to_unix() -
-						                   thread->get_unix_date());
-
-					row.set_value(thread_summary_columns.ppm, std::move(ppm));
+					row.set_value(thread_summary_columns.ppm, thread->get_velocity());
 					row.set_value(thread_summary_columns.thread_summary,
 					                             thread);
 					summary_map.erase(match_iter);
@@ -535,21 +559,21 @@ namespace Horizon {
 					iter->set_value(thread_summary_columns.image_count,
 					                thread->get_image_count());
 					iter->set_value(thread_summary_columns.ppm, 
-					                static_cast<float>(thread->get_reply_count()) /
-					                static_cast<float>(Glib::DateTime::
-					                                   create_now_utc().to_unix() -
-					                                   thread->get_unix_date()));
+					                thread->get_velocity());
 					new_count++;
 				}
 				int erase_count = 0;
 				for ( auto pair : erase_map ) {
 					// The Gtk::TreeRow in the pair is now invalid
 					const gint64 id_to_erase = pair.first;
+					summary_renderer->forget_layout(id_to_erase);
 					auto slot = sigc::bind(sigc::mem_fun(*this, &Application::erase_iter_if_match_id), id_to_erase);
 					model->foreach_iter(slot);
 					erase_count++;
 				}
 
+				queue_catalog_prioritize();
+
 				std::cerr << "Catalog updated. " << new_count << " new, " 
 				          << update_count << " updated, " << erase_count 
 				          << " expired." << std::endl;
@@ -561,6 +585,45 @@ namespace Horizon {
 		}
 	}
 
+	void Application::queue_catalog_prioritize() {
+		if (!catalog_prioritize_idle.connected())
+			catalog_prioritize_idle = Glib::signal_idle().connect(sigc::mem_fun(*this, &Application::on_catalog_prioritize));
+	}
+
+	/*
+	 * Moves the thumbnails of the rows on screen to the front of the
+	 * catalog fetcher's queue, followed by a page of rows above and
+	 * below. Everything further away is pushed to the back.
+	 */
+	bool Application::on_catalog_prioritize() {
+		Gtk::TreeModel::Path start_path, end_path;
+		if ( !summary_view->get_visible_range(start_path, end_path) )
+			return false;
+
+		const int first  = start_path.front();
+		const int last   = end_path.front();
+		const int margin = last - first + 1;
+		std::map<std::string, REQUEST_PRIORITY> priorities;
+		int row_number = 0;
+		for ( auto row : model->children() ) {
+			if ( row_number > last + margin )
+				break;
+
+			if ( row_number >= first - margin ) {
+				auto thread = row.get_value(thread_summary_columns.thread_summary);
+				if ( thread && !row.get_value(thread_summary_columns.thumb) ) {
+					const bool is_visible = row_number >= first && row_number <= last;
+					const REQUEST_PRIORITY priority = is_visible ? PRIORITY_VISIBLE : PRIORITY_NEAR;
+					priorities.insert({thread->get_hash(), priority});
+				}
+			}
+			++row_number;
+		}
+
+		catalog_image_fetcher->prioritize(priorities, PRIORITY_FAR);
+		return false;
+	}
+
 	bool Application::erase_iter_if_match_id(const Gtk::TreeModel::iterator& iter, const gint64 id) {
 		gint64 row_id = iter->get_value(thread_summary_columns.id);
 		if (row_id == id) {
@@ -634,8 +697,11 @@ namespace Horizon {
 
 	Application::~Application() {
 		canceller->cancel();
+		if (catalog_prioritize_idle.connected())
+			catalog_prioritize_idle.disconnect();
 		manager_alarm.disconnect();
 		summary_alarm.disconnect();
+		tab_ticker.disconnect();
 	}
 
 
@@ -656,6 +722,7 @@ namespace Horizon {
 		const std::string path = Glib::build_filename( path_parts );
 		const Glib::RefPtr<Gio::File> cache_file = Gio::File::create_for_path(path);
 		image_cache           = std::make_shared<ImageCache>(cache_file);
+		pixbuf_cache          = std::make_shared<PixbufCache>(PIXBUF_CACHE_BUDGET);
 	}
 
 }
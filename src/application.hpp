@@ -23,6 +23,7 @@
 #include "manager.hpp"
 #include "thread_view.hpp"
 #include "summary_cellrenderer.hpp"
+#include "pixbuf_cache.hpp"
 
 namespace Horizon {
 	class Application {
@@ -56,11 +57,16 @@ namespace Horizon {
 		Horizon::Manager manager;
 		std::weak_ptr<Notifier> notifier;
 		std::shared_ptr<ImageCache> image_cache;
+		std::shared_ptr<PixbufCache> pixbuf_cache;
 		std::shared_ptr<ImageFetcher> catalog_image_fetcher;
 		std::weak_ptr<ImageFetcher> chan_image_fetcher;
 		std::shared_ptr<Canceller> canceller;
 		sigc::connection manager_alarm;
 		sigc::connection summary_alarm;
+		sigc::connection tab_ticker;
+		bool on_tab_tick();
+		void on_settings_changed(const Glib::ustring &key);
+		void apply_cache_quotas();
 		
 		Glib::RefPtr<Gio::Settings> settings;
 		std::vector<Glib::ustring> threads;
@@ -70,11 +76,15 @@ namespace Horizon {
 		Gtk::Notebook* notebook;
 
 		Gtk::TreeView* summary_view;
+		SummaryCellRenderer* summary_renderer;
 		void refresh_catalog_view();
 		bool erase_iter_if_match_id(const Gtk::TreeModel::iterator& iter, const gint64 id);
 		void on_catalog_board_change();
 		void on_catalog_image(const Glib::RefPtr<Gdk::PixbufLoader> &loader,
 		                      Glib::RefPtr<ThreadSummary> thread);
+		sigc::connection catalog_prioritize_idle;
+		void queue_catalog_prioritize();
+		bool on_catalog_prioritize();
 		Glib::RefPtr<Gtk::ListStore> model;
 		Gtk::ComboBoxText *board_combobox;
 		bool board_combobox_add_board(const std::string& board,
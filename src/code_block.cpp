@@ -0,0 +1,241 @@
+#include "code_block.hpp"
+#include <gtkmm/button.h>
+#include <gtkmm/entry.h>
+#include <glibmm/main.h>
+#include <pangomm/attrlist.h>
+#include <algorithm>
+#include <vector>
+
+namespace Horizon {
+
+	namespace {
+		class LanguageColumns : public Gtk::TreeModel::ColumnRecord {
+		public:
+			Gtk::TreeModelColumn<Glib::ustring> id;
+
+			LanguageColumns() { add(id); }
+		};
+
+		const LanguageColumns& get_language_columns() {
+			static const LanguageColumns columns;
+			return columns;
+		}
+
+		/* Every code block's language chooser shares this model */
+		Glib::RefPtr<Gtk::ListStore> get_language_model() {
+			static Glib::RefPtr<Gtk::ListStore> model;
+
+			if (!model) {
+				const auto &columns = get_language_columns();
+				model = Gtk::ListStore::create(columns);
+				for (auto id : Gsv::LanguageManager::get_default()->get_language_ids()) {
+					auto row = *(model->append());
+					row[columns.id] = id;
+				}
+			}
+
+			return model;
+		}
+
+		struct LanguageHint {
+			const char *language;
+			const char *pattern;
+			int         weight;
+		};
+
+		/*
+		 * What code posted to 4chan usually looks like. A hint counts
+		 * once however often it appears.
+		 */
+		const LanguageHint LANGUAGE_HINTS[] = {
+			{"c",          "#include <stdio.h>",       4},
+			{"c",          "#include <stdlib.h>",      3},
+			{"c",          "#include <string.h>",      3},
+			{"c",          "printf(",                  2},
+			{"c",          "malloc(",                  2},
+			{"c",          "int main(",                1},
+			{"c",          "#include",                 1},
+			{"c",          "->",                       1},
+			{"cpp",        "#include <iostream>",      5},
+			{"cpp",        "#include <vector>",        4},
+			{"cpp",        "#include",                 1},
+			{"cpp",        "std::",                    3},
+			{"cpp",        "template <",               3},
+			{"cpp",        "template<",                3},
+			{"cpp",        "cout <<",                  3},
+			{"cpp",        "nullptr",                  2},
+			{"cpp",        "int main(",                1},
+			{"python",     "def ",                     2},
+			{"python",     "elif ",                    3},
+			{"python",     "self.",                    2},
+			{"python",     "__init__",                 3},
+			{"python",     " in range(",               3},
+			{"python",     "print(",                   1},
+			{"python",     "import ",                  1},
+			{"sh",         "#!/bin/sh",                5},
+			{"sh",         "#!/bin/bash",              5},
+			{"sh",         "; then",                   3},
+			{"sh",         "; do",                     3},
+			{"sh",         "echo ",                    1},
+			{"sh",         "sudo ",                    2},
+			{"js",         "console.log",              5},
+			{"js",         "function(",                2},
+			{"js",         "document.",                3},
+			{"js",         "=>",                       1},
+			{"js",         "var ",                     1},
+			{"java",       "public static void main",  5},
+			{"java",       "System.out.print",         5},
+			{"java",       "import java.",             5},
+			{"java",       "public class ",            2},
+			{"c-sharp",    "Console.Write",            5},
+			{"c-sharp",    "using System",             5},
+			{"rust",       "fn main()",                4},
+			{"rust",       "let mut ",                 4},
+			{"rust",       "println!",                 4},
+			{"rust",       "impl ",                    2},
+			{"go",         "package main",             5},
+			{"go",         "fmt.",                     3},
+			{"go",         ":=",                       2},
+			{"go",         "func ",                    2},
+			{"haskell",    "putStrLn",                 5},
+			{"haskell",    "import qualified",         5},
+			{"haskell",    " <- ",                     1},
+			{"sql",        "SELECT ",                  3},
+			{"sql",        " FROM ",                   2},
+			{"sql",        "INSERT INTO",              5},
+			{"sql",        "CREATE TABLE",             5},
+			{"php",        "<?php",                    6},
+			{"php",        "$this->",                  3},
+			{"perl",       "use strict",               5},
+			{"perl",       "my $",                     4},
+			{"ruby",       "puts ",                    2},
+			{"ruby",       "require '",                2},
+			{"lua",        "local function",           4},
+			{"lua",        "local ",                   1},
+			{"commonlisp", "(defun ",                  5},
+			{"commonlisp", "(setf ",                   3},
+			{"scheme",     "(define ",                 5},
+			{"html",       "<!DOCTYPE",                5},
+			{"html",       "<html",                    4},
+			{"html",       "<div",                     3},
+			{"latex",      "\\documentclass",          6},
+			{"latex",      "\\begin{",                 4},
+		};
+
+		// Weakest total a guess needs, so a stray "->" isn't C
+		const int LANGUAGE_GUESS_THRESHOLD = 3;
+	}
+
+	std::string guess_code_language(const std::string &code) {
+		std::vector<std::pair<std::string, int> > scores;
+
+		for (const auto &hint : LANGUAGE_HINTS) {
+			if (code.find(hint.pattern) == code.npos)
+				continue;
+
+			auto iter = std::find_if(scores.begin(), scores.end(),
+			                         [&hint](const std::pair<std::string, int> &score) {
+				                         return score.first.compare(hint.language) == 0; });
+			if (iter == scores.end())
+				scores.push_back(std::make_pair(std::string(hint.language), hint.weight));
+			else
+				iter->second += hint.weight;
+		}
+
+		int best = 0, runner_up = 0;
+		std::string language;
+		for (const auto &score : scores) {
+			if (score.second > best) {
+				runner_up = best;
+				best = score.second;
+				language = score.first;
+			} else if (score.second > runner_up) {
+				runner_up = score.second;
+			}
+		}
+
+		if (best < LANGUAGE_GUESS_THRESHOLD || best == runner_up)
+			return std::string();
+
+		return language;
+	}
+
+	CodeBlock::CodeBlock(const Glib::ustring &code_text_,
+	                     const std::string &language_,
+	                     sigc::slot<void, const Glib::ustring&> on_launch_) :
+		code_text(code_text_),
+		language(language_),
+		on_launch(on_launch_),
+		placeholder(Gtk::manage(new Gtk::Label())),
+		language_box(nullptr)
+	{
+		Pango::AttrList attributes;
+		auto family = Pango::Attribute::create_attr_family("monospace");
+		attributes.insert(family);
+
+		placeholder->set_text(code_text);
+		placeholder->set_attributes(attributes);
+		placeholder->set_selectable(true);
+		placeholder->set_halign(Gtk::ALIGN_START);
+		placeholder->set_valign(Gtk::ALIGN_START);
+		placeholder->set_justify(Gtk::JUSTIFY_LEFT);
+		draw_connection = placeholder->signal_draw().connect(sigc::mem_fun(*this, &CodeBlock::on_placeholder_draw), false);
+		attach(*placeholder, 0, 1, 3, 1);
+	}
+
+	CodeBlock::~CodeBlock() {
+		draw_connection.disconnect();
+		build_idle.disconnect();
+	}
+
+	/*
+	 * Only widgets in the visible part of the thread get drawn, so this
+	 * is when we are first scrolled into view. The hierarchy can't change
+	 * during a draw, so build the real view from an idle.
+	 */
+	bool CodeBlock::on_placeholder_draw(const Cairo::RefPtr<Cairo::Context>&) {
+		draw_connection.disconnect();
+		if (!build_idle.connected())
+			build_idle = Glib::signal_idle().connect(sigc::mem_fun(*this, &CodeBlock::build_view));
+
+		return false;
+	}
+
+	bool CodeBlock::build_view() {
+		auto const lmgr     = Gsv::LanguageManager::get_default();
+		auto btn   = Gtk::manage(new Gtk::Button("Launch Editor"));
+		auto label = Gtk::manage(new Gtk::Label(""));
+		buffer = Gsv::Buffer::create();
+		auto sview = Gtk::manage(new Gsv::View(buffer));
+		language_box = Gtk::manage(new Gtk::ComboBox(true));
+
+		label       ->set_hexpand(true);
+		btn         ->set_hexpand(false);
+		language_box->set_hexpand(false);
+		buffer->set_text(code_text);
+		// Plain text when there was no clear guess
+		if (!language.empty())
+			buffer->set_language(lmgr->get_language(language));
+
+		language_box->set_model(get_language_model());
+		language_box->set_entry_text_column(get_language_columns().id);
+		language_box->get_entry()->set_text(language);
+		language_box->signal_changed().connect(sigc::mem_fun(*this, &CodeBlock::on_language_changed));
+		btn->signal_clicked().connect(sigc::bind(on_launch, code_text));
+
+		remove(*placeholder);
+		placeholder = nullptr;
+		attach(*language_box, 0, 0, 1, 1);
+		attach(*label,        1, 0, 1, 1);
+		attach(*btn,          2, 0, 1, 1);
+		attach(*sview,        0, 1, 3, 1);
+		show_all();
+
+		return false;
+	}
+
+	void CodeBlock::on_language_changed() {
+		auto const lmgr = Gsv::LanguageManager::get_default();
+		buffer->set_language(lmgr->get_language(language_box->get_entry()->get_text()));
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef CODE_BLOCK_HPP
+#define CODE_BLOCK_HPP
+
+#include <gtkmm/grid.h>
+#include <gtkmm/label.h>
+#include <gtkmm/combobox.h>
+#include <gtkmm/liststore.h>
+#include <gtksourceviewmm.h>
+#include <sigc++/functors/slot.h>
+
+namespace Horizon {
+
+	/*
+	 * A code tag from a comment. Starts out as a plain monospace
+	 * label, and only builds the source view, language chooser and
+	 * editor button the first time it is drawn.
+	 */
+	class CodeBlock : public Gtk::Grid {
+	public:
+		/* language is a GtkSourceView language id, or empty for plain text */
+		CodeBlock(const Glib::ustring &code_text,
+		          const std::string &language,
+		          sigc::slot<void, const Glib::ustring&> on_launch);
+		virtual ~CodeBlock();
+
+	private:
+		CodeBlock() = delete;
+		CodeBlock(const CodeBlock&) = delete;
+		CodeBlock& operator=(const CodeBlock&) = delete;
+
+		const Glib::ustring                     code_text;
+		const std::string                       language;
+		sigc::slot<void, const Glib::ustring&>  on_launch;
+
+		Gtk::Label                             *placeholder;
+		Glib::RefPtr<Gsv::Buffer>               buffer;
+		Gtk::ComboBox                          *language_box;
+		sigc::connection                        draw_connection;
+		sigc::connection                        build_idle;
+
+		bool on_placeholder_draw(const Cairo::RefPtr<Cairo::Context>&);
+		bool build_view();
+		void on_language_changed();
+	};
+
+	/*
+	 * Guesses the GtkSourceView language id of a code tag from words
+	 * and idioms each language is known by. Returns an empty string
+	 * when no language clearly wins. Safe to call from any thread.
+	 */
+	std::string guess_code_language(const std::string &code);
+}
+
+#endif
@@ -0,0 +1,133 @@
+#include "comment_renderer.hpp"
+#include <thread>
+#include <algorithm>
+#include <iostream>
+#include "html_parser.hpp"
+#include "code_block.hpp"
+#include "utils.hpp"
+
+namespace Horizon {
+
+	CommentRenderer::CommentRenderer(const unsigned int num_workers,
+	                                 RenderCache &cache_in) :
+		cache(cache_in),
+		pending(0),
+		is_stopping(false)
+	{
+		const sigc::slot<void> slot = sigc::mem_fun(*this, &CommentRenderer::worker);
+
+		for (unsigned int i = 0; i < num_workers; i++) {
+			Glib::Threads::Thread *thread = nullptr;
+			int trycount = 0;
+
+			while ( thread == nullptr && trycount++ < 10 ) {
+				try {
+					thread = Horizon::create_named_thread("Comment Render", slot);
+				} catch ( Glib::Threads::ThreadError e) {
+					if (e.code() != Glib::Threads::ThreadError::AGAIN) {
+						g_error("Couldn't create CommentRenderer thread: %s",
+						        e.what().c_str());
+					}
+				}
+			}
+
+			if (thread == nullptr)
+				g_error("Couldn't create CommentRenderer thread, too many tries");
+
+			workers.push_back(thread);
+		}
+	}
+
+	CommentRenderer::~CommentRenderer() {
+		{
+			Glib::Threads::Mutex::Lock lock(mutex);
+			is_stopping = true;
+			job_cond.broadcast();
+		}
+
+		for (auto thread : workers)
+			thread->join();
+	}
+
+	/* Guesses what language each code segment is in */
+	static void guess_languages(RenderedComment &rendered) {
+		bool is_code = true;
+
+		rendered.languages.clear();
+		rendered.languages.reserve(rendered.segments.size());
+		for (const auto &segment : rendered.segments) {
+			is_code = !is_code;
+			rendered.languages.push_back(is_code ? guess_code_language(segment.text.raw())
+			                                     : std::string());
+		}
+	}
+
+	/* Called on the Manager's thread curler thread */
+	void CommentRenderer::render(const std::list<Glib::RefPtr<Post> > &posts) {
+		std::list<Glib::RefPtr<Post> > misses;
+
+		for (auto post : posts) {
+			auto rendered = cache.lookup(post);
+			if (rendered && rendered->languages.size() != rendered->segments.size()) {
+				// Loaded from disk, which doesn't keep the guesses
+				auto guessed = std::make_shared<RenderedComment>(*rendered);
+				guess_languages(*guessed);
+				cache.insert(post, guessed);
+				rendered = guessed;
+			}
+
+			if (rendered)
+				post->set_rendered_comment(rendered);
+			else
+				misses.push_back(post);
+		}
+
+		if (misses.size() == 0)
+			return;
+
+		Glib::Threads::Mutex::Lock lock(mutex);
+		std::copy(misses.begin(), misses.end(), std::back_inserter(jobs));
+		pending += misses.size();
+		job_cond.broadcast();
+
+		while (pending > 0)
+			done_cond.wait(mutex);
+	}
+
+	/* Runs on each of the worker threads */
+	void CommentRenderer::worker() {
+		auto parser = HtmlParser::getHtmlParser();
+		Glib::Threads::Mutex::Lock lock(mutex);
+
+		while (true) {
+			while (jobs.empty() && !is_stopping)
+				job_cond.wait(mutex);
+
+			if (is_stopping)
+				break;
+
+			Glib::RefPtr<Post> post = jobs.front();
+			jobs.pop_front();
+			lock.release();
+
+			auto rendered = std::make_shared<RenderedComment>();
+			const std::string comment = post->get_comment();
+			rendered->segments = parser->html_to_pango(comment, post->get_thread_id());
+			rendered->links = parser->get_links(comment);
+			guess_languages(*rendered);
+			post->set_rendered_comment(rendered);
+			cache.insert(post, rendered);
+			post.reset();
+
+			lock.acquire();
+			if (--pending == 0)
+				done_cond.broadcast();
+		}
+	}
+
+	unsigned int get_comment_renderer_worker_count() {
+		const unsigned int cpus = std::thread::hardware_concurrency();
+
+		return std::max(1u, std::min(4u, cpus > 1 ? cpus - 1 : 1u));
+	}
+}
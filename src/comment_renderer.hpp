@@ -0,0 +1,48 @@
+#ifndef COMMENT_RENDERER_HPP
+#define COMMENT_RENDERER_HPP
+#include <deque>
+#include <list>
+#include <vector>
+#include <glibmm/threads.h>
+#include "thread.hpp"
+#include "render_cache.hpp"
+
+namespace Horizon {
+
+	/*
+	 * A small pool of worker threads that turn comment HTML into text
+	 * and attributes before posts reach the main thread. Each worker
+	 * has its own HtmlParser. Posts found in the RenderCache skip
+	 * parsing, and everything parsed is added to it.
+	 */
+	class CommentRenderer {
+	public:
+		CommentRenderer(const unsigned int num_workers, RenderCache &cache);
+		~CommentRenderer();
+		CommentRenderer(const CommentRenderer&) = delete;
+		CommentRenderer& operator=(const CommentRenderer&) = delete;
+
+		/*
+		 * Renders each post's comment and attaches the result to the
+		 * post. Returns once all of them are done.
+		 */
+		void render(const std::list<Glib::RefPtr<Post> > &posts);
+
+	private:
+		RenderCache &cache;
+
+		Glib::Threads::Mutex mutex;
+		Glib::Threads::Cond  job_cond;
+		Glib::Threads::Cond  done_cond;
+		std::deque<Glib::RefPtr<Post> > jobs;
+		std::size_t          pending;
+		bool                 is_stopping;
+
+		std::vector<Glib::Threads::Thread*> workers;
+		void worker();
+	};
+
+	unsigned int get_comment_renderer_worker_count();
+}
+
+#endif
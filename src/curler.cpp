@@ -10,6 +10,22 @@
 
 namespace Horizon {
 
+	/*
+	 * Catalog teasers are HTML escaped text. Decode them once here so
+	 * searching sees the real text, and the summary renderer escapes
+	 * them for Pango.
+	 */
+	static void decode_teaser(HorizonThreadSummary *summary) {
+		const gchar *teaser = horizon_thread_summary_get_teaser(summary);
+		if (!teaser || !std::strchr(teaser, '&'))
+			return;
+
+		gchar *decoded = g_strdup(teaser);
+		decode_html_entities_utf8(decoded, NULL);
+		g_object_set(summary, "teaser", decoded, NULL);
+		g_free(decoded);
+	}
+
 
 	static size_t curler_thread_cb(char *ptr, size_t size, size_t nmemb, void* userdata)
 	{
@@ -187,6 +203,7 @@ namespace Horizon {
 				const gchar *member_name = static_cast<gchar*>(data);
 				JsonNode *object = json_object_get_member(threads, member_name);
 				GObject *csummary = json_gobject_deserialize( horizon_thread_summary_get_type(), object );
+				decode_teaser(HORIZON_THREAD_SUMMARY(csummary));
 				Glib::RefPtr<ThreadSummary> summary = Glib::wrap(HORIZON_THREAD_SUMMARY(csummary));
 				summary->set_id(member_name);
 				summary->set_board(board.c_str());
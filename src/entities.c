@@ -4,6 +4,10 @@
 #include <string.h>
 #include <stdlib.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define UNICODE_MAX 0x10FFFFul
 
 static const char *named_entities[][2] =
@@ -263,19 +267,111 @@ static const char *named_entities[][2] =
 	{ "zwnj;", "\xE2\x80\x8C" }
 };
 
-static int cmp(const void *key, const void *element)
+/*
+ * Perfect hash over named_entities. A name's FNV-1a hash picks one of
+ * ENTITY_BUCKETS buckets, and the bucket's displacement remixes the hash
+ * into a slot of entity_slots holding the entry's index, or
+ * ENTITY_EMPTY. The tables were found offline by trying displacements
+ * for the largest buckets first, so any edit to named_entities means
+ * regenerating them.
+ */
+#define ENTITY_BUCKETS 128
+#define ENTITY_SLOTS   512
+#define ENTITY_EMPTY   255
+#define ENTITY_MAX_LENGTH 32
+
+static const unsigned char entity_displacements[ENTITY_BUCKETS] =
+{
+	  0,   0,   1,   0,   0,   1,   0,   2,   0,   2,   0,   0,   2,   8,   0,   0,
+	  1,   0,   0,   1,   0,   0,   0,   2,   0,   2,  12,   4,   2,   0,   0,   2,
+	  0,   1,   2,   0,   1,   0,   0,   1,   0,   7,   0,   0,   0,   0,   4,   0,
+	  4,   0,   1,   1,   3,   0,   0,   1,   0,   0,   1,   1,   0,   1,   1,   0,
+	  2,   0,   1,   1,   2,   0,   0,   0,   2,   1,   0,   3,   1,   0,   2,   0,
+	  2,   1,   4,   0,   0,   2,   4,   8,   0,   5,   1,   0,   0,   0,   0,   1,
+	  0,   0,   0,   0,   0,   0,   0,   0,   2,   0,   0,   0,   0,   2,   0,   0,
+	  1,   0,   3,   4,   0,   1,   0,   2,   0,   0,   0,   0,   0,   2,   8,   0
+};
+
+static const unsigned char entity_slots[ENTITY_SLOTS] =
+{
+	234,   7, 164, 255, 116,  38,  14, 255,  43, 255,  34, 255, 107,   8, 222, 255,
+	115, 255, 198, 255, 101,  61,  21, 255, 255, 255, 255, 255, 255, 255, 255, 142,
+	 62, 112, 255, 111, 255, 255, 180, 255, 141, 231, 255, 120,  37, 255, 238, 106,
+	255, 131, 242, 255, 255, 255,   5, 255, 173,   2, 218, 192, 255, 243, 255, 255,
+	 11,  51, 151,  24, 144, 247,  58, 255, 255,  36, 138,  99, 193, 255, 255,  60,
+	255, 255, 167, 255, 255, 232, 255, 255, 255, 140, 155, 163, 244, 255, 255,  92,
+	255, 135, 134, 255,  59, 255,  66, 255, 255,  45,  19, 255,  67, 255,  49,  42,
+	123,  94, 255, 255, 255, 241, 187,  88, 213, 255, 255, 255, 160, 255,  75, 255,
+	255, 246, 255, 255, 255, 255, 255, 148, 206, 255, 255,  76, 255, 210, 255, 255,
+	255, 255, 156, 159, 255, 228,  52, 255,  18, 255, 255, 255, 225, 150, 255, 255,
+	255,  68,  40, 255,  74, 255, 255, 188, 255, 255, 255, 255, 255, 255, 255, 255,
+	255,  46, 255, 255, 220, 255,  63, 233, 235, 255, 255,   6, 139, 181, 255, 255,
+	 80, 255, 203, 109,   9,  84, 255,  32, 177,  28, 255, 170, 255, 255, 201, 240,
+	255,  85, 255,  89,   0, 255, 171, 255, 255, 255, 117, 223, 255, 255, 194, 255,
+	255, 124, 255, 255, 255,  53, 255, 248, 195,  12, 255,  96, 127,  86,   3, 179,
+	255, 255, 255, 207, 255, 255,  33, 255, 217, 255,  16, 255, 255, 255, 255, 145,
+	255, 255, 204,  82, 208, 255, 255, 255,  23, 255, 255, 255, 239, 136, 202, 200,
+	255, 255,  17, 255, 255, 175, 227, 230, 113, 224, 219, 255, 236, 255,  64, 255,
+	190, 147, 255, 255,  77, 189, 176, 133,  55, 196, 100,  87, 168, 255, 255, 197,
+	255, 199,   1, 209, 102, 255,  39, 157, 178, 255, 255,  56, 255, 255, 130, 255,
+	114,  65, 255, 143, 255, 255, 255, 255,  54, 154,  81, 255,  83, 110, 153,  47,
+	  4, 255, 255, 255,  69, 166, 255,  26, 185, 162, 255, 255, 255, 255, 255, 255,
+	255,  35, 255, 105, 250, 255,  13, 255, 255,  44, 158, 229, 255,  50, 255, 103,
+	255, 255, 255,  31, 255, 215, 255,  98, 146, 129, 255, 249,  70,  97, 245, 125,
+	137,  78, 169, 255,  10, 251, 255, 255, 121, 255, 165,  95, 255, 255, 183, 255,
+	255,  91, 255, 255,  30, 255, 255,  71, 255,  20,  57, 174, 152,  25, 255, 221,
+	255, 255, 255, 255, 255, 255, 255, 216, 255, 255, 255, 132, 255, 255, 255, 255,
+	255, 255, 205, 237, 255, 255, 255, 122, 255, 149,  29, 255, 255, 255, 255, 108,
+	255, 252, 118, 255, 255, 255, 255, 255, 226,  15, 255, 191, 126, 255, 255,  22,
+	184, 211, 182, 128,  90,  27, 255, 255,  93, 255, 255,  48,  79, 255, 255, 255,
+	255, 255, 119, 255, 255, 255, 255, 255, 255, 255,  41, 255, 255, 255, 161, 255,
+	255,  73, 212,  72, 255, 255, 104, 186, 255, 172, 255, 255, 255, 214, 255, 255
+};
+
+static unsigned int entity_hash(const char *name, size_t len)
+{
+	unsigned int h = 2166136261u;
+	for(size_t i = 0; i < len; i++)
+		h = (h ^ (unsigned char)name[i]) * 16777619u;
+
+	return h;
+}
+
+const char *lookup_html_entity(const char *name, size_t len)
 {
-	return strncmp((const char *)key, *(const char **)element,
-		strlen(*(const char **)element));
+	unsigned int h = entity_hash(name, len);
+	unsigned int d = entity_displacements[h & (ENTITY_BUCKETS - 1)];
+	unsigned int slot = ((h ^ (d * 0x9E3779B9u)) * 0x85EBCA6Bu) >> 23;
+
+	unsigned char index = entity_slots[slot];
+	if(index == ENTITY_EMPTY) return NULL;
+
+	const char *candidate = named_entities[index][0];
+	if(strncmp(candidate, name, len) || candidate[len] != ';')
+		return NULL;
+
+	return named_entities[index][1];
 }
 
-static const char *get_named_entity(const char *name)
+/* First '&' in [s, end), or end */
+static const char *find_amp(const char *s, const char *end)
 {
-	const char **entity = bsearch(name, named_entities,
-		sizeof(named_entities) / sizeof(*named_entities),
-		sizeof(*named_entities), cmp);
+#ifdef __SSE2__
+	/* Only whole blocks are loaded, so nothing past end is read */
+	const __m128i amp = _mm_set1_epi8('&');
+
+	for(; end - s >= 16; s += 16)
+	{
+		__m128i chunk = _mm_loadu_si128((const __m128i *)s);
+		unsigned int mask = (unsigned int)_mm_movemask_epi8(
+			_mm_cmpeq_epi8(chunk, amp));
+		if(mask) return s + __builtin_ctz(mask);
+	}
+#endif
+	for(; s < end; s++)
+		if(*s == '&') return s;
 
-	return entity ? entity[1] : NULL;
+	return end;
 }
 
 static size_t putc_utf8(unsigned long cp, char *buffer)
@@ -318,8 +414,12 @@ static size_t putc_utf8(unsigned long cp, char *buffer)
 static _Bool parse_entity(const char *current, char **to,
 	const char **from)
 {
-	const char *end = strchr(current, ';');
-	if(!end) return 0;
+	/* No entity is longer than this, so don't go hunting the whole
+	   text for a ';' after every stray '&' */
+	const char *end = current + 1;
+	while(*end && *end != ';' && end - current < ENTITY_MAX_LENGTH)
+		end++;
+	if(*end != ';') return 0;
 
 	if(current[1] == '#')
 	{
@@ -341,7 +441,8 @@ static _Bool parse_entity(const char *current, char **to,
 	}
 	else
 	{
-		const char *entity = get_named_entity(&current[1]);
+		const char *entity = lookup_html_entity(&current[1],
+			(size_t)(end - current - 1));
 		if(entity)
 		{
 			size_t len = strlen(entity);
@@ -364,10 +465,14 @@ size_t decode_html_entities_utf8(char *dest, const char *src)
 	char *to = dest;
 	const char *from = src;
 
+	const char *end = src + strlen(src);
 	const char *current;
-	while((current = strchr(from, '&')))
+	while((current = find_amp(from, end)) != end)
 	{
-		memcpy(to, from, (size_t)(current - from));
+		/* Decoding in place, nothing needs moving until the first
+		   entity shrinks the text */
+		if(to != from)
+			memmove(to, from, (size_t)(current - from));
 		to += current - from;
 
 		if(parse_entity(current, &to, &from))
@@ -377,9 +482,10 @@ size_t decode_html_entities_utf8(char *dest, const char *src)
 		*to++ = *from++;
 	}
 
-	size_t remaining = strlen(from);
+	size_t remaining = (size_t)(current - from);
 
-	memcpy(to, from, remaining);
+	if(to != from)
+		memmove(to, from, remaining);
 	to += remaining;
 
 	*to = 0;
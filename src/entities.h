@@ -3,6 +3,10 @@
 
 #include <stddef.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 extern size_t decode_html_entities_utf8(char *dest, const char *src);
 /*	if `src` is `NULL`, input will be taken from `dest`, decoding
 	the entities in-place
@@ -14,4 +18,15 @@ extern size_t decode_html_entities_utf8(char *dest, const char *src);
 	the function returns the length of the decoded string
 */
 
+extern const char *lookup_html_entity(const char *name, size_t len);
+/*	looks up the named entity `name`, `len` bytes long and without
+	the leading '&' or trailing ';'
+
+	returns its UTF-8 expansion, or `NULL` if it isn't known
+*/
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
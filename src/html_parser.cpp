@@ -1,20 +1,23 @@
 #include "html_parser.hpp"
+#include "entities.h"
 #include <iostream>
 #include <map>
+#include <algorithm>
+#include <cstring>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace Horizon {
 
 	std::shared_ptr<HtmlParser> HtmlParser::getHtmlParser() {
-		static auto ptr = std::shared_ptr<HtmlParser>(new HtmlParser());
+		static thread_local auto ptr = std::shared_ptr<HtmlParser>(new HtmlParser());
 
 		return ptr;
 	}
 
 	HtmlParser::HtmlParser() :
-		is_OP_link(false),
-		is_cross_thread_link(false),
-		is_dead_link(false),
-		is_code_tagged(false)
+		ctxt_in_use(false)
 	{
 		sax = g_new0(xmlSAXHandler, 1);
 		sax->startElement = &horizon_html_parser_on_start_element;
@@ -23,7 +26,7 @@ namespace Horizon {
 		sax->serror = &horizon_html_parser_on_xml_error;
 		sax->initialized = XML_SAX2_MAGIC;
 
-		ctxt = htmlCreatePushParserCtxt(sax, this, NULL, 0, NULL,
+		ctxt = htmlCreatePushParserCtxt(sax, nullptr, NULL, 0, NULL,
 		                                XML_CHAR_ENCODING_UTF8);
 		if (G_UNLIKELY( ctxt == NULL )) {
 			g_error("Unable to create libxml2 HTML context!");
@@ -54,55 +57,627 @@ namespace Horizon {
 		return links;
 	}
 
-	std::list<Glib::ustring> HtmlParser::html_to_pango(const std::string &html, const gint64 id) {
+	namespace {
+		enum FAST_TAG { FAST_TAG_A, FAST_TAG_S, FAST_TAG_EM, FAST_TAG_SPAN, FAST_TAG_PRE };
+		const std::size_t FAST_MAX_DEPTH = 16;
+
+		inline bool is_special_byte(const unsigned char c) {
+			return c == '<' || c == '&' || c <= 0x1F || c == 0x7F || c == 0xC2;
+		}
+
+		inline bool is_name_byte(const char c) {
+			return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9');
+		}
+
+		inline bool name_equals(const char *s, const std::size_t len, const char *name) {
+			return std::strlen(name) == len && std::memcmp(s, name, len) == 0;
+		}
+
+		/*
+		 * Returns the offset of the first byte at or after pos that
+		 * needs a closer look: markup, an entity, a control character,
+		 * or the lead byte of a C1 control.
+		 */
+		std::size_t find_special(const char *s, std::size_t pos, const std::size_t len) {
+#ifdef __SSE2__
+			const __m128i lt   = _mm_set1_epi8('<');
+			const __m128i amp  = _mm_set1_epi8('&');
+			const __m128i del  = _mm_set1_epi8(0x7F);
+			const __m128i c1   = _mm_set1_epi8(static_cast<char>(0xC2));
+			const __m128i ctl  = _mm_set1_epi8(0x1F);
+			const __m128i zero = _mm_setzero_si128();
+
+			while (pos + 16 <= len) {
+				const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + pos));
+				__m128i m = _mm_or_si128(_mm_cmpeq_epi8(chunk, lt),
+				                         _mm_cmpeq_epi8(chunk, amp));
+				m = _mm_or_si128(m, _mm_cmpeq_epi8(chunk, del));
+				m = _mm_or_si128(m, _mm_cmpeq_epi8(chunk, c1));
+				// Bytes <= 0x1F saturate to zero
+				m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_subs_epu8(chunk, ctl), zero));
+
+				const int mask = _mm_movemask_epi8(m);
+				if (mask != 0)
+					return pos + __builtin_ctz(mask);
+				pos += 16;
+			}
+#endif
+			for (; pos < len; pos++) {
+				if (is_special_byte(static_cast<unsigned char>(s[pos])))
+					return pos;
+			}
+
+			return len;
+		}
+	}
+
+	void horizon_html_parser_classify_quotelink(const std::string &url,
+	                                            const gint64 thread_id,
+	                                            bool &is_OP_link,
+	                                            bool &is_cross_thread_link) {
+		const std::size_t offset = url.find_last_of('p') + 1;
+		const gint64 link_post_id = g_ascii_strtoll(url.c_str() + std::min(offset, url.size()),
+		                                            nullptr,
+		                                            10);
+
+		std::size_t parent_offset = offset >= 3 ? offset - 3 : 0;
+		while (parent_offset > 0 && g_ascii_isdigit(url[parent_offset]))
+			--parent_offset;
+		if (parent_offset != 0)
+			++parent_offset;
+
+		const gint64 link_parent_id = g_ascii_strtoll(url.c_str() + parent_offset,
+		                                              nullptr,
+		                                              10);
+
+		is_OP_link = link_post_id == link_parent_id;
+		is_cross_thread_link = link_parent_id != thread_id;
+	}
+
+	/*
+	 * Decodes the entity starting at s[pos], which is an '&', leaving
+	 * pos after its ';'. Named entities come from the entities.c table,
+	 * and only characters libxml2 passes through unchanged are accepted.
+	 */
+	bool ParseContext::tokenize_entity(const char *s, const std::size_t len,
+	                                 std::size_t &pos, gunichar &c) const {
+		const std::size_t start = pos + 1;
+		std::size_t end = start;
+		while (end < len && end - start < 10 && s[end] != ';')
+			end++;
+		if (end >= len || s[end] != ';' || end == start)
+			return false;
+
+		const char *name = s + start;
+		const std::size_t name_len = end - start;
+		if (name[0] == '#') {
+			if (name_len < 2)
+				return false;
+
+			gint64 value = 0;
+			const bool hex = name[1] == 'x' || name[1] == 'X';
+			std::size_t i = hex ? 2 : 1;
+			if (i == name_len)
+				return false;
+			for (; i < name_len; i++) {
+				const char d = name[i];
+				if (hex && g_ascii_isxdigit(d))
+					value = value * 16 + g_ascii_xdigit_value(d);
+				else if (!hex && g_ascii_isdigit(d))
+					value = value * 10 + g_ascii_digit_value(d);
+				else
+					return false;
+			}
+
+			if (!(value == '\t' || value == '\n' ||
+			      (value >= 0x20 && value < 0x7F) ||
+			      (value >= 0xA0 && value <= 0xD7FF) ||
+			      (value >= 0xE000 && value <= 0xFFFD) ||
+			      (value >= 0x10000 && value <= 0x10FFFF)))
+				return false;
+
+			c = static_cast<gunichar>(value);
+		} else if (name_equals(name, name_len, "amp")) {
+			c = '&';
+		} else if (name_equals(name, name_len, "lt")) {
+			c = '<';
+		} else if (name_equals(name, name_len, "gt")) {
+			c = '>';
+		} else if (name_equals(name, name_len, "quot")) {
+			c = '"';
+		} else if (name_equals(name, name_len, "apos")) {
+			c = '\'';
+		} else if (name_equals(name, name_len, "lang") ||
+		           name_equals(name, name_len, "rang")) {
+			// entities.c and libxml2 disagree on these two
+			return false;
+		} else {
+			const char *expansion = lookup_html_entity(name, name_len);
+			if (!expansion)
+				return false;
+			c = g_utf8_get_char(expansion);
+		}
+
+		pos = end + 1;
+		return true;
+	}
+
+	void ParseContext::append_unichar(const gunichar c) {
+		gchar utf8[6];
+		const gint utf8_len = g_unichar_to_utf8(c, utf8);
+		text.append(utf8, utf8_len);
+	}
+
+	/*
+	 * Handles the tag starting at s[pos], which is a '<', leaving pos
+	 * after its '>'. Tags are only accepted where libxml2 would not
+	 * close or reorder anything, so the output matches it exactly.
+	 */
+	bool ParseContext::tokenize_tag(const char *s, const std::size_t len, std::size_t &pos) {
+		std::size_t p = pos + 1;
+		const bool is_end = p < len && s[p] == '/';
+		if (is_end)
+			p++;
+
+		const std::size_t name_start = p;
+		while (p < len && is_name_byte(s[p]))
+			p++;
+		const char *name = s + name_start;
+		const std::size_t name_len = p - name_start;
+		if (name_len == 0 || p >= len)
+			return false;
+
+		if (is_end) {
+			if (s[p] != '>' || fast_stack.empty())
+				return false;
+			pos = p + 1;
+
+			const int top = fast_stack.back();
+			if (name_equals(name, name_len, "a") && top == FAST_TAG_A) {
+				close_link();
+			} else if (name_equals(name, name_len, "span") && top == FAST_TAG_SPAN) {
+				close_style();
+			} else if (name_equals(name, name_len, "em") && top == FAST_TAG_EM) {
+				close_style();
+			} else if (name_equals(name, name_len, "s") && top == FAST_TAG_S) {
+			} else if (name_equals(name, name_len, "pre") && top == FAST_TAG_PRE) {
+				end_segment();
+				is_code_tagged = false;
+			} else {
+				return false;
+			}
+
+			fast_stack.pop_back();
+			return true;
+		}
+
+		// Attributes, of which only class and href matter
+		bool have_class = false, have_href = false;
+		fast_class.clear();
+		fast_href.clear();
+		while (true) {
+			if (s[p] == '>')
+				break;
+			if (s[p] != ' ')
+				return false;
+			while (p < len && s[p] == ' ')
+				p++;
+			if (p >= len)
+				return false;
+			if (s[p] == '>')
+				break;
+
+			const std::size_t attr_start = p;
+			while (p < len && ((s[p] >= 'a' && s[p] <= 'z') || s[p] == '-'))
+				p++;
+			const std::size_t attr_len = p - attr_start;
+			if (attr_len == 0 || p + 1 >= len || s[p] != '=' || s[p+1] != '"')
+				return false;
+			p += 2;
+
+			std::string *value = nullptr;
+			if (name_equals(s + attr_start, attr_len, "class")) {
+				if (have_class)
+					return false;
+				have_class = true;
+				value = &fast_class;
+			} else if (name_equals(s + attr_start, attr_len, "href")) {
+				if (have_href)
+					return false;
+				have_href = true;
+				value = &fast_href;
+			}
+
+			while (p < len && s[p] != '"') {
+				if (s[p] == '&') {
+					gunichar c;
+					if (!tokenize_entity(s, len, p, c))
+						return false;
+					if (value) {
+						gchar utf8[6];
+						value->append(utf8, g_unichar_to_utf8(c, utf8));
+					}
+				} else if (s[p] == '<' || static_cast<unsigned char>(s[p]) <= 0x1F) {
+					return false;
+				} else {
+					if (value)
+						value->push_back(s[p]);
+					p++;
+				}
+			}
+			if (p >= len)
+				return false;
+			p++;
+			if (p >= len)
+				return false;
+		}
+		pos = p + 1;
+
+		const bool in_a = std::find(fast_stack.begin(), fast_stack.end(),
+		                            static_cast<int>(FAST_TAG_A)) != fast_stack.end();
+		if (fast_stack.size() >= FAST_MAX_DEPTH)
+			return false;
+
+		if (name_equals(name, name_len, "br") ||
+		    name_equals(name, name_len, "wbr")) {
+			// The libxml2 path matches "br" anywhere in the name
+			text.push_back('\n');
+		} else if (is_code_tagged) {
+			return false;
+		} else if (name_equals(name, name_len, "a")) {
+			if (in_a || !have_href)
+				return false;
+			if (have_class && fast_class.find("quotelink") != fast_class.npos) {
+				open_style(COMMENT_STYLE_QUOTELINK, fast_href);
+				horizon_html_parser_classify_quotelink(fast_href, thread_id,
+				                                       is_OP_link,
+				                                       is_cross_thread_link);
+			} else {
+				open_style(COMMENT_STYLE_LINK, fast_href);
+			}
+			fast_stack.push_back(FAST_TAG_A);
+		} else if (name_equals(name, name_len, "span")) {
+			if (!have_class)
+				return false;
+			if (fast_class.find("spoiler") != fast_class.npos) {
+				open_style(COMMENT_STYLE_SPOILER, std::string());
+			} else if (fast_class.find("quote") != fast_class.npos) {
+				open_style(COMMENT_STYLE_QUOTE, std::string());
+			} else if (fast_class.compare("deadlink") == 0) {
+				open_style(COMMENT_STYLE_NONE, std::string());
+				is_dead_link = true;
+			} else {
+				return false;
+			}
+			fast_stack.push_back(FAST_TAG_SPAN);
+		} else if (name_equals(name, name_len, "em")) {
+			open_style(COMMENT_STYLE_ITALIC, std::string());
+			fast_stack.push_back(FAST_TAG_EM);
+		} else if (name_equals(name, name_len, "s")) {
+			fast_stack.push_back(FAST_TAG_S);
+		} else if (name_equals(name, name_len, "pre")) {
+			if (!fast_stack.empty() || !have_class ||
+			    fast_class.find("prettyprint") == fast_class.npos)
+				return false;
+			end_segment();
+			is_code_tagged = true;
+			fast_stack.push_back(FAST_TAG_PRE);
+		} else {
+			return false;
+		}
+
+		return true;
+	}
+
+	bool ParseContext::tokenize(const std::string &html) {
+		const char *s = html.data();
+		const std::size_t len = html.size();
+
+		if (!g_utf8_validate(s, len, nullptr))
+			return false;
+
+		// libxml2 skips blanks before the document
+		std::size_t pos = 0;
+		while (pos < len && (s[pos] == ' ' || s[pos] == '\t' ||
+		                     s[pos] == '\n' || s[pos] == '\r'))
+			pos++;
+
+		while (pos < len) {
+			const std::size_t next = find_special(s, pos, len);
+			if (next > pos) {
+				text.append(s + pos, next - pos);
+				pos = next;
+			}
+			if (pos >= len)
+				break;
+
+			const unsigned char c = static_cast<unsigned char>(s[pos]);
+			switch (c) {
+			case '<':
+				if (!tokenize_tag(s, len, pos))
+					return false;
+				break;
+			case '&': {
+				gunichar uc;
+				if (!tokenize_entity(s, len, pos, uc))
+					return false;
+				append_unichar(uc);
+				break;
+			}
+			case '\t':
+			case '\n':
+				text.push_back(static_cast<char>(c));
+				pos++;
+				break;
+			case 0xC2:
+				if (pos + 1 < len &&
+				    static_cast<unsigned char>(s[pos+1]) >= 0x80 &&
+				    static_cast<unsigned char>(s[pos+1]) <= 0x9F)
+					return false;
+				text.append(s + pos, 2);
+				pos += 2;
+				break;
+			default:
+				return false;
+			}
+		}
+
+		return fast_stack.empty();
+	}
+
+	ParseContext::ParseContext() :
+		is_OP_link(false),
+		is_cross_thread_link(false),
+		is_dead_link(false),
+		is_code_tagged(false),
+		thread_id(0)
+	{
+	}
+
+	void ParseContext::reset(const gint64 id) {
+		segments.clear();
+		is_OP_link = false;
+		is_cross_thread_link = false;
+		is_dead_link = false;
+		is_code_tagged = false;
 		thread_id = id;
-		built_string.clear();
-		strings.clear();
-		xmlFreeDoc(htmlCtxtReadMemory(ctxt,
-		                              html.c_str(), 
-		                              html.size(),
-		                              NULL,
-		                              "UTF-8",
-		                              HTML_PARSE_RECOVER ));
-		                              
-		strings.push_back(built_string);
-		return strings;
+		libxml_opened.clear();
+		text.clear();
+		open_styles.clear();
+		styles.clear();
+		links.clear();
+		fast_stack.clear();
+	}
+
+	void ParseContext::append_text(const char *s, const std::size_t len) {
+		text.append(s, len);
+	}
+
+	void ParseContext::open_style(const COMMENT_STYLE style, const std::string &href) {
+		open_styles.push_back(OpenStyle{style, text.size(), href});
+	}
+
+	/* Records the part of open that is in the current segment */
+	void ParseContext::add_style(const OpenStyle &open) {
+		if (open.start >= text.size())
+			return;
+
+		const guint32 start = static_cast<guint32>(open.start);
+		const guint32 end = static_cast<guint32>(text.size());
+		if (open.style != COMMENT_STYLE_NONE)
+			styles.push_back(CommentStyle{start, end, open.style});
+		if (open.style == COMMENT_STYLE_QUOTELINK || open.style == COMMENT_STYLE_LINK)
+			links.push_back(CommentLink{start, end, open.href});
+	}
+
+	void ParseContext::close_style() {
+		if (open_styles.empty())
+			return;
+
+		add_style(open_styles.back());
+		open_styles.pop_back();
+	}
+
+	void ParseContext::close_link() {
+		if (is_OP_link)
+			text.append(" (OP)");
+		if (is_cross_thread_link)
+			text.append(" (Cross-Thread)");
+		if (is_dead_link) {
+			text.append(" (Dead)");
+			is_dead_link = false;
+		}
+		close_style();
+	}
+
+	/*
+	 * Styles still open carry on into the next segment. Code segments
+	 * drop theirs.
+	 */
+	void ParseContext::end_segment() {
+		const bool is_code = segments.size() % 2 == 1;
+		for (const auto &open : open_styles)
+			add_style(open);
+
+		// Labels never showed leading or trailing newlines
+		const std::size_t first = std::min(text.find_first_not_of('\n'), text.size());
+		const std::size_t last = std::max(text.find_last_not_of('\n') + 1, first);
+		const auto clip = [first, last](guint32 &start, guint32 &end) {
+			start = static_cast<guint32>(std::min(std::max<std::size_t>(start, first), last) - first);
+			end = static_cast<guint32>(std::min(std::max<std::size_t>(end, first), last) - first);
+			return start < end;
+		};
+
+		CommentSegment segment;
+		segment.text = Glib::ustring(text.substr(first, last - first));
+		if (!is_code) {
+			for (auto style : styles) {
+				if (clip(style.start, style.end))
+					segment.styles.push_back(style);
+			}
+			for (auto link : links) {
+				if (clip(link.start, link.end))
+					segment.links.push_back(std::move(link));
+			}
+			segment.attributes = make_comment_attributes(segment.styles);
+		}
+		segments.push_back(std::move(segment));
+
+		text.clear();
+		styles.clear();
+		links.clear();
+		for (auto &open : open_styles)
+			open.start = 0;
+	}
+
+	std::unique_ptr<ParseContext> HtmlParser::acquire_context(const gint64 thread_id) {
+		std::unique_ptr<ParseContext> context;
+
+		if (free_contexts.empty()) {
+			context.reset(new ParseContext());
+		} else {
+			context = std::move(free_contexts.back());
+			free_contexts.pop_back();
+		}
+
+		context->reset(thread_id);
+		return context;
+	}
+
+	void HtmlParser::release_context(std::unique_ptr<ParseContext> context) {
+		free_contexts.push_back(std::move(context));
+	}
+
+	void HtmlParser::parse_with_libxml(const std::string &html, ParseContext &context) {
+		if (!ctxt_in_use) {
+			ctxt_in_use = true;
+			ctxt->userData = &context;
+			xmlFreeDoc(htmlCtxtReadMemory(ctxt,
+			                              html.c_str(), 
+			                              html.size(),
+			                              NULL,
+			                              "UTF-8",
+			                              HTML_PARSE_RECOVER ));
+			ctxt->userData = nullptr;
+			ctxt_in_use = false;
+		} else {
+			// Re-entered while our libxml2 context is busy
+			xmlParserCtxtPtr nested = htmlCreatePushParserCtxt(sax, &context,
+			                                                   NULL, 0, NULL,
+			                                                   XML_CHAR_ENCODING_UTF8);
+			if (G_UNLIKELY( nested == NULL )) {
+				g_error("Unable to create libxml2 HTML context!");
+			}
+			xmlFreeDoc(htmlCtxtReadMemory(nested,
+			                              html.c_str(),
+			                              html.size(),
+			                              NULL,
+			                              "UTF-8",
+			                              HTML_PARSE_RECOVER ));
+			htmlFreeParserCtxt(nested);
+		}
+
+		context.end_segment();
+	}
+
+	std::list<CommentSegment> HtmlParser::html_to_pango(const std::string &html, const gint64 id) {
+		auto context = acquire_context(id);
+		std::list<CommentSegment> segments;
+
+		if (context->tokenize(html)) {
+			context->end_segment();
+		} else {
+			context->reset(id);
+			parse_with_libxml(html, *context);
+		}
+		segments.swap(context->segments);
+
+		release_context(std::move(context));
+
+		return segments;
+	}
+
+	std::list<CommentSegment> HtmlParser::html_to_pango_with_libxml(const std::string &html, const gint64 id) {
+		auto context = acquire_context(id);
+		std::list<CommentSegment> segments;
+
+		parse_with_libxml(html, *context);
+		segments.swap(context->segments);
+		release_context(std::move(context));
+
+		return segments;
+	}
+
+	Pango::AttrList make_comment_attributes(const std::vector<CommentStyle> &styles) {
+		Pango::AttrList attributes;
+
+		for (const auto &style : styles) {
+			std::vector<Pango::Attribute> attrs;
+			switch (style.style) {
+			case COMMENT_STYLE_QUOTELINK:
+				attrs.push_back(Pango::Attribute::create_attr_foreground(0xDDDD, 0, 0));
+				attrs.push_back(Pango::Attribute::create_attr_underline(Pango::UNDERLINE_SINGLE));
+				break;
+			case COMMENT_STYLE_LINK:
+				attrs.push_back(Pango::Attribute::create_attr_foreground(0x3434, 0x3434, 0x5C5C));
+				attrs.push_back(Pango::Attribute::create_attr_underline(Pango::UNDERLINE_SINGLE));
+				break;
+			case COMMENT_STYLE_SPOILER:
+				attrs.push_back(Pango::Attribute::create_attr_foreground(0, 0, 0));
+				attrs.push_back(Pango::Attribute::create_attr_background(0, 0, 0));
+				break;
+			case COMMENT_STYLE_QUOTE:
+				attrs.push_back(Pango::Attribute::create_attr_foreground(0x7878, 0x9999, 0x2222));
+				break;
+			case COMMENT_STYLE_ITALIC:
+				attrs.push_back(Pango::Attribute::create_attr_style(Pango::STYLE_ITALIC));
+				break;
+			case COMMENT_STYLE_NONE:
+				break;
+			}
+
+			for (auto &attr : attrs) {
+				attr.set_start_index(style.start);
+				attr.set_end_index(style.end);
+				attributes.insert(attr);
+			}
+		}
+
+		return attributes;
 	}
 
 	void horizon_html_parser_on_end_element(void* user_data,
 	                                        const xmlChar* name) {
 
-		HtmlParser *hp = static_cast<HtmlParser*>(user_data);
+		ParseContext *hp = static_cast<ParseContext*>(user_data);
 		std::stringstream s;
 		s << reinterpret_cast<const char*>(name);
 		std::string sname(s.str());
 
+		bool opened = false;
+		if (!hp->libxml_opened.empty()) {
+			opened = hp->libxml_opened.back();
+			hp->libxml_opened.pop_back();
+		}
+
 		if ( sname.size() == 1 &&
 		     sname.find("a") != sname.npos ) {
-			if (hp->is_OP_link) {
-				hp->built_string.append(" (OP)");
-			}
-			if (hp->is_cross_thread_link) {
-				hp->built_string.append(" (Cross-Thread)");
-			}
-			if (hp->is_dead_link) {
-				hp->built_string.append(" (Dead)");
-				hp->is_dead_link = false;
+			if (opened)
+				hp->close_link();
+		} else if ( sname.find("pre") != sname.npos ) {
+			if (opened) {
+				hp->end_segment();
+				hp->is_code_tagged = false;
 			}
-			hp->built_string.append("</span></a>");
+		} else if ( opened ) {
+			hp->close_style();
 		} else if ( sname.find("span") != sname.npos ) {
-			hp->built_string.append("</span>");
 		} else if ( sname.find("html") != sname.npos ) {
 		} else if ( sname.find("body") != sname.npos ) {
 		} else if ( sname.find("br") != sname.npos ) {
 		} else if ( sname.size() == 1 &&
 		            sname.find("p") != sname.npos ) {
-		} else if ( sname.find("pre") != sname.npos ) {
-			hp->strings.push_back(hp->built_string);
-			hp->built_string.clear();
-			hp->is_code_tagged = false;
 		} else if ( sname.compare("em") == 0 ) {
-			hp->built_string.append("</i>");
 		}
 
 		else 
@@ -112,12 +687,13 @@ namespace Horizon {
 	void horizon_html_parser_on_start_element(void* user_data,
 	                                          const xmlChar* name,
 	                                          const xmlChar** attrs) {
-		HtmlParser* hp = static_cast<HtmlParser*>(user_data);
+		ParseContext* hp = static_cast<ParseContext*>(user_data);
+		// Whether the matching end element has anything to close
+		bool opened = false;
 		if (name != nullptr) {
 			try {
 				Glib::ustring sname( reinterpret_cast<const char*>(name) );
 				std::map<Glib::ustring, Glib::ustring> sattrs;
-				std::stringstream stream;
 
 				if (attrs != nullptr) {
 					for ( int i = 0; attrs[i] != nullptr; i += 2) {
@@ -137,77 +713,59 @@ namespace Horizon {
 				} else if ( sname.size() == 1 &&
 				            sname.find("p") != sname.npos ) {
 				} else if ( sname.find("br") != Glib::ustring::npos ) {
-					hp->built_string.append("\n");
+					hp->append_text("\n", 1);
 				} else if ( sname.size() == 1 && 
 				            sname.find("a") != Glib::ustring::npos &&
 				            sattrs.count("class") == 1 &&
 				            sattrs["class"].find("quotelink") != Glib::ustring::npos &&
 				            sattrs.count("href") == 1) {
 					auto const url     = sattrs["href"];
-					auto const offset  = url.find_last_of("p") + 1;
-					auto const postnum = sattrs["href"].substr(offset);
-					stream << "<a href=\"" << url << "\">"
-					       << "<span color=\"#D00\">";
-					hp->built_string.append(stream.str());
-
-					auto parent_offset = offset - 3;
-					while (parent_offset > 0 && g_ascii_isdigit(url.c_str()[parent_offset]))
-						--parent_offset;
-					if (parent_offset != 0)
-						++parent_offset;
-
-					auto const link_parent_id = g_ascii_strtoll(url.substr(parent_offset).c_str(),
-					                                            nullptr,
-					                                            10);
-					auto const link_post_id = g_ascii_strtoll(postnum.c_str(),
-					                                          nullptr,
-					                                          10);
-
-					if ( link_post_id == link_parent_id )
-						hp->is_OP_link = true;
-					else
-						hp->is_OP_link = false;
-					if ( link_parent_id == hp->thread_id )
-						hp->is_cross_thread_link = false;
-					else
-						hp->is_cross_thread_link = true;
+					hp->open_style(COMMENT_STYLE_QUOTELINK, url.raw());
+					opened = true;
+
+					horizon_html_parser_classify_quotelink(url.raw(), hp->thread_id,
+					                                       hp->is_OP_link,
+					                                       hp->is_cross_thread_link);
 				} else if (sname.find("span") != sname.npos &&
 				           sattrs.count("class") == 1 &&
 				           sattrs["class"].find("spoiler") != Glib::ustring::npos ) {
-					stream << "<span color=\"#000\" background=\"#000\">";
-					hp->built_string.append(stream.str());
-
+					hp->open_style(COMMENT_STYLE_SPOILER, std::string());
+					opened = true;
 				} else if ( sname.find("span") != sname.npos &&
 				            sattrs.count("class") == 1 &&
 				            sattrs["class"].find("quote") != sname.npos ) {
-					stream << "<span color=\"#789922\">";
-					hp->built_string.append(stream.str());
+					hp->open_style(COMMENT_STYLE_QUOTE, std::string());
+					opened = true;
 				} else if ( sname.find("pre") != sname.npos &&
 				            sattrs.count("class") == 1 &&
 				            sattrs["class"].find("prettyprint") != Glib::ustring::npos ) {
-					hp->strings.push_back(hp->built_string);
-					hp->built_string.clear();
+					hp->end_segment();
 					hp->is_code_tagged = true;
+					opened = true;
 				} else if ( sname.compare("a") == 0 &&
 				            sattrs.find("href") != sattrs.end() ) {
-					stream << "<a href=\"" << sattrs["href"] << "\"><span color=\"#34345C\">";
-					hp->built_string.append(stream.str());
+					hp->open_style(COMMENT_STYLE_LINK, sattrs["href"].raw());
+					opened = true;
+				} else if ( sname.compare("a") == 0 ) {
+					// Nothing to style, but the end still gets its notes
+					hp->open_style(COMMENT_STYLE_NONE, std::string());
+					opened = true;
 				} else if ( sname.compare("span") == 0 &&
 				            sattrs.count("class") == 1 &&
 				            sattrs["class"].compare("deadlink") == 0) {
-					stream << "<span>";
+					hp->open_style(COMMENT_STYLE_NONE, std::string());
 					hp->is_dead_link = true;
-					hp->built_string.append(stream.str());
+					opened = true;
 				} else if (sname.compare("span") == 0) {
-					stream << "<span>";
+					hp->open_style(COMMENT_STYLE_NONE, std::string());
+					opened = true;
 					std::cerr << "Debug: Unhandled span attributes: ";
 					for ( auto pair : sattrs )
 						std::cerr << "\"" << pair.first << "\" = \"" << pair.second << "\" ";
 					std::cerr << std::endl;					
-					hp->built_string.append(stream.str());
 				} else if (sname.compare("em") == 0) {
-					stream << "<i>";
-					hp->built_string.append(stream.str());
+					hp->open_style(COMMENT_STYLE_ITALIC, std::string());
+					opened = true;
 				}
 
 				else {
@@ -228,20 +786,15 @@ namespace Horizon {
 				          << std::endl;
 			}
 		}
+
+		hp->libxml_opened.push_back(opened);
 	}
 
 	void horizon_html_parser_on_characters(void* user_data,
 	                                       const xmlChar* chars,
 	                                       int size) {
-		HtmlParser* hp = static_cast<HtmlParser*>(user_data);
-		if (!hp->is_code_tagged) {
-			gchar* cstr = g_markup_escape_text(reinterpret_cast<const gchar*>(chars), size);
-			hp->built_string.append(Glib::ustring(cstr));
-			g_free(cstr);
-		} else {
-			std::string str(reinterpret_cast<const char*>(chars), size);
-			hp->built_string.append(str);
-		}
+		ParseContext* hp = static_cast<ParseContext*>(user_data);
+		hp->append_text(reinterpret_cast<const char*>(chars), size);
 	}
 
 	void horizon_html_parser_on_xml_error(void*, xmlErrorPtr error) {
@@ -3,18 +3,135 @@
 
 #include <memory>
 #include <list>
+#include <vector>
+#include <string>
 #include <glibmm/ustring.h>
+#include <pangomm/attrlist.h>
 #include <libxml/HTMLparser.h>
 
 namespace Horizon {
 
+	enum COMMENT_STYLE {
+		COMMENT_STYLE_NONE,
+		COMMENT_STYLE_QUOTELINK,
+		COMMENT_STYLE_LINK,
+		COMMENT_STYLE_SPOILER,
+		COMMENT_STYLE_QUOTE,
+		COMMENT_STYLE_ITALIC
+	};
+
+	/* Ranges are byte offsets into the segment's text */
+	struct CommentStyle {
+		guint32 start;
+		guint32 end;
+		COMMENT_STYLE style;
+	};
+
+	struct CommentLink {
+		guint32 start;
+		guint32 end;
+		std::string href;
+	};
+
+	/*
+	 * One piece of a comment as html_to_pango emits it. Code
+	 * segments are plain text, with no styles or links.
+	 */
+	struct CommentSegment {
+		Glib::ustring text;
+		std::vector<CommentStyle> styles;
+		/* Built from styles, ready for Gtk::Label::set_attributes */
+		Pango::AttrList attributes;
+		/*
+		 * Labels only make links out of markup they parse
+		 * themselves, so clicks are looked up here instead.
+		 */
+		std::vector<CommentLink> links;
+	};
+
+	Pango::AttrList make_comment_attributes(const std::vector<CommentStyle> &styles);
+
+	/*
+	 * Everything one call to html_to_pango needs, so parsers can be
+	 * used from several threads and re-entered.
+	 */
+	class ParseContext {
+	public:
+		ParseContext();
+
+		void reset(const gint64 thread_id);
+
+		std::list<CommentSegment> segments;
+		bool is_OP_link;
+		bool is_cross_thread_link;
+		bool is_dead_link;
+		bool is_code_tagged;
+		gint64 thread_id;
+
+		/*
+		 * Single pass tokenizer for the handful of tags 4chan puts in
+		 * comments. Returns false if it sees anything it doesn't
+		 * know, in which case the context is reset and libxml2 gets
+		 * it.
+		 */
+		bool tokenize(const std::string &html);
+
+		/*
+		 * Builds segments for both tokenize and the libxml2
+		 * callbacks. Styles nest, and close_style ends the innermost
+		 * one.
+		 */
+		void append_text(const char *s, const std::size_t len);
+		void open_style(const COMMENT_STYLE style, const std::string &href);
+		void close_style();
+		/* Ends an <a>, adding the (OP), (Cross-Thread) and (Dead) notes */
+		void close_link();
+		void end_segment();
+
+		/* Whether each element libxml2 is inside opened a style */
+		std::vector<bool> libxml_opened;
+
+	private:
+		bool tokenize_tag(const char *s, const std::size_t len, std::size_t &pos);
+		bool tokenize_entity(const char *s, const std::size_t len,
+		                     std::size_t &pos, gunichar &c) const;
+		void append_unichar(const gunichar c);
+
+		struct OpenStyle {
+			COMMENT_STYLE style;
+			std::size_t start;
+			std::string href;
+		};
+
+		void add_style(const OpenStyle &open);
+
+		std::string text;
+		std::vector<OpenStyle> open_styles;
+		std::vector<CommentStyle> styles;
+		std::vector<CommentLink> links;
+
+		std::string fast_href;
+		std::string fast_class;
+		std::vector<int> fast_stack;
+	};
+
 	class HtmlParser {
 	public:
+		/* The calling thread's parser */
 		static std::shared_ptr<HtmlParser> getHtmlParser();
 		~HtmlParser();
 
-		std::list<Glib::ustring> html_to_pango(const std::string& html, const gint64 thread_id);
+		/*
+		 * Splits a comment into text and attributes, alternating
+		 * between markup and code segments and starting with markup.
+		 */
+		std::list<CommentSegment> html_to_pango(const std::string& html, const gint64 thread_id);
 		std::list<gint64> get_links(const std::string& html);
+		/*
+		 * html_to_pango without the tokenizer, which must always
+		 * agree with it. Used by the parser checks.
+		 */
+		std::list<CommentSegment> html_to_pango_with_libxml(const std::string& html, const gint64 thread_id);
 
 	protected:
 		HtmlParser();
@@ -22,18 +139,14 @@ namespace Horizon {
 	private:
 		htmlSAXHandlerPtr sax;
 		xmlParserCtxtPtr ctxt;
-		std::list<Glib::ustring> strings;
-		Glib::ustring built_string;
-		bool is_OP_link;
-		bool is_cross_thread_link;
-		bool is_dead_link;
-		bool is_code_tagged;
-		gint64 thread_id;
-		
-		friend void horizon_html_parser_on_end_element(void* user_data, const xmlChar* name);
-		friend void horizon_html_parser_on_start_element(void* user_data, const xmlChar* name, const xmlChar** attrs);
-		friend void horizon_html_parser_on_characters(void* user_data, const xmlChar* chars, int len);
-		friend void horizon_html_parser_on_xml_error(void* user_data, xmlErrorPtr error);
+		bool ctxt_in_use;
+
+		/* Contexts are kept between calls so their buffers are reused */
+		std::vector<std::unique_ptr<ParseContext> > free_contexts;
+		std::unique_ptr<ParseContext> acquire_context(const gint64 thread_id);
+		void release_context(std::unique_ptr<ParseContext> context);
+
+		void parse_with_libxml(const std::string &html, ParseContext &context);
 	};
 
 	void horizon_html_parser_on_end_element(void* user_data, const xmlChar* name);
@@ -41,6 +154,10 @@ namespace Horizon {
 	void horizon_html_parser_on_characters(void* user_data, const xmlChar* chars, int len);
 	void horizon_html_parser_on_xml_error(void* user_data, xmlErrorPtr error);
 	size_t horizon_html_parser_write_cb(void *ptr, size_t size, size_t nmemb, void *data);
+	void horizon_html_parser_classify_quotelink(const std::string &url,
+	                                            const gint64 thread_id,
+	                                            bool &is_OP_link,
+	                                            bool &is_cross_thread_link);
 
 }
 
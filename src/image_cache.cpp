@@ -1,5 +1,8 @@
 #include <array>
 #include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
 #include <glibmm/convert.h>
 #include <glibmm/miscutils.h>
 #include <glibmm/fileutils.h>
@@ -9,27 +12,71 @@
 
 namespace Horizon {
 
-	struct SArrayGFreer {
-		void operator()(const gchar** s) {
-			g_free(s);
+	static const std::array<const gchar*, IMAGE_EXT_OTHER> known_exts{ {".jpg", ".png", ".gif",
+				".webm", ".pdf", ".swf", ".mp4"} };
+
+	static GQuark intern(const gchar *string) {
+		return g_quark_from_string(string);
+	}
+
+	static void intern_strv(const std::unique_ptr<GVariant, VariantUnrefer> &varray,
+	                        SmallSet<GQuark, 2> &set,
+	                        const bool bytestrings) {
+		if (!varray)
+			return;
+
+		GVariantIter iter;
+		g_variant_iter_init(&iter, varray.get());
+		const gchar *string = nullptr;
+		while (g_variant_iter_next(&iter, bytestrings ? "^&ay" : "&s", &string))
+			set.insert(intern(string));
+	}
+
+	static GVariant* quarks_to_array(const SmallSet<GQuark, 2> &set,
+	                                 const bool bytestrings) {
+		GVariantBuilder builder;
+		g_variant_builder_init(&builder,
+		                       bytestrings ? G_VARIANT_TYPE_BYTESTRING_ARRAY : G_VARIANT_TYPE_STRING_ARRAY);
+
+		for ( auto quark : set ) {
+			const gchar *string = g_quark_to_string(quark);
+			g_variant_builder_add_value(&builder,
+			                            bytestrings ? g_variant_new_bytestring(string) : g_variant_new_string(string));
 		}
-	};
 
-	ImageData::ImageData(const guint32 version, const std::unique_ptr<GVariant, VariantUnrefer> cvariant) {
+		return g_variant_builder_end(&builder);
+	}
+
+	ImageData::ImageData(const guint32 version, const std::unique_ptr<GVariant, VariantUnrefer> cvariant) :
+		size(0),
+		last_access(0),
+		thumb_size(0),
+		thumb_pack(0),
+		thumb_offset(0),
+		num_spoiler(0),
+		num_deleted(0),
+		have_thumbnail(false),
+		have_image(false),
+		flags(0),
+		ext(IMAGE_EXT_JPG),
+		unusual_md5(0),
+		unusual_ext(0)
+	{
 		const gsize cvariant_children = g_variant_n_children(cvariant.get());
-		if ( version == 1 ) {
-			if (cvariant_children != 12) {
-				g_error("Invalid number of elements in version 1 data: %" G_GSIZE_FORMAT " elements.",
-				        cvariant_children);
+		if ( version == 1 || version == 2 ) {
+			const gsize expected_children = version == 1 ? 12 : 17;
+			if (cvariant_children != expected_children) {
+				g_error("Invalid number of elements in version %" G_GUINT32_FORMAT " data: %" G_GSIZE_FORMAT " elements.",
+				        version, cvariant_children);
 			} else {
 				typedef std::unique_ptr<GVariant, VariantUnrefer> v_ptr;
-				typedef std::unique_ptr<const gchar*, SArrayGFreer> sarray_ptr;
 				const gchar *string;
+				gboolean have = FALSE;
 				g_variant_get_child(cvariant.get(), 0, "t", &size);
 				g_variant_get_child(cvariant.get(), 1, "^&ay", &string);
-				md5 = string;
+				set_md5(string);
 				g_variant_get_child(cvariant.get(), 2, "^&ay", &string);
-				ext = string;
+				set_ext(string);
 				const v_ptr vboards   (g_variant_get_child_value(cvariant.get(), 3));
 				const v_ptr vtags     (g_variant_get_child_value(cvariant.get(), 4));
 				const v_ptr vfilenames(g_variant_get_child_value(cvariant.get(), 5));
@@ -37,51 +84,27 @@ namespace Horizon {
 				const v_ptr vdates    (g_variant_get_child_value(cvariant.get(), 7));
 				g_variant_get_child(cvariant.get(), 8, "q",&num_spoiler);
 				g_variant_get_child(cvariant.get(), 9, "q",&num_deleted);
-				g_variant_get_child(cvariant.get(), 10, "b", &have_thumbnail);
-				g_variant_get_child(cvariant.get(), 11, "b", &have_image);
-
-				if (vboards) {
-					const gsize arraysize = g_variant_n_children(vboards.get());
-					if (arraysize > 0) {
-						const sarray_ptr sarray(g_variant_get_strv(vboards.get(),
-						                                           nullptr));
-						for ( gsize i = 0; i < arraysize; ++i ) {
-							boards.insert(sarray.get()[i]);
-						}
-					}
+				g_variant_get_child(cvariant.get(), 10, "b", &have);
+				have_thumbnail = have;
+				g_variant_get_child(cvariant.get(), 11, "b", &have);
+				have_image = have;
+				if (version == 2) {
+					g_variant_get_child(cvariant.get(), 12, "x", &last_access);
+					g_variant_get_child(cvariant.get(), 13, "u", &thumb_size);
+					g_variant_get_child(cvariant.get(), 14, "y", &flags);
+					g_variant_get_child(cvariant.get(), 15, "u", &thumb_pack);
+					g_variant_get_child(cvariant.get(), 16, "u", &thumb_offset);
 				}
 
-				if (vtags) {
-					const gsize arraysize = g_variant_n_children(vtags.get());
-					if (arraysize > 0) {
-						const sarray_ptr sarray(g_variant_get_strv(vtags.get(),
-						                                           nullptr));
-						for ( gsize i = 0; i < arraysize; i++ ) {
-							tags.insert(sarray.get()[i]);
-						}
-					}
-				}
-				
-				if (vfilenames) {
-					const gsize arraysize = g_variant_n_children(vfilenames.get());
-					if (arraysize > 0) {
-						const sarray_ptr sarray(g_variant_get_bytestring_array(vfilenames.get(),
-						                                                       nullptr));
-						for ( gsize i = 0; i < arraysize; i++ ) {
-							original_filenames.insert(sarray.get()[i]);
-						}
-					}
-				}
+				intern_strv(vboards,  boards,       false);
+				intern_strv(vtags,    tags,         false);
+				intern_strv(vposters, poster_names, true);
 
-				if (vposters) {
-					const gsize arraysize = g_variant_n_children(vposters.get());
-					if (arraysize > 0) {
-						const sarray_ptr sarray(g_variant_get_bytestring_array(vposters.get(),
-						                                                 nullptr));
-						for ( gsize i = 0; i < arraysize; i++ ) {
-							poster_names.insert(sarray.get()[i]);
-						}
-					}
+				if (vfilenames) {
+					GVariantIter iter;
+					g_variant_iter_init(&iter, vfilenames.get());
+					while (g_variant_iter_next(&iter, "^&ay", &string))
+						add_filename(string);
 				}
 
 				if (vdates) {
@@ -97,118 +120,120 @@ namespace Horizon {
 		}
 	}
 
-	ImageData::ImageData(const guint32 version, const Glib::VariantContainerBase& variant) {
-		/*
-		  Glib::Variant<>::create has a memory leak in Gtk < 3.8
-		 */
-		gsize num = variant.get_n_children();
-		if ( version == 1 ) {
-			if (num != 12) {
-				g_error("Invalid number of elements in version 1 data: %" G_GSIZE_FORMAT " elements.", num);
-			}
-			Glib::Variant< guint64 >                      vsize;
-			Glib::Variant< std::string >                  vmd5;
-			Glib::Variant< std::string >                  vext;
-			Glib::Variant< std::vector< Glib::ustring > > vboards;
-			Glib::Variant< std::vector< Glib::ustring > > vtags;
-			Glib::Variant< std::vector< std::string > >   vfilenames;
-			Glib::Variant< std::vector< std::string > >   vposters;
-			Glib::Variant< std::vector< gint64 > >        vdates;
-			Glib::Variant< guint16 >                      vspoilers;
-			Glib::Variant< guint16 >                      vdeleted;
-			Glib::Variant< bool >                         vhave_thumb;
-			Glib::Variant< bool >                         vhave_image;
-			variant.get_child(vsize,         0);
-			variant.get_child(vmd5,          1);
-			variant.get_child(vext,          2);
-			variant.get_child(vboards,       3);
-			variant.get_child(vtags,         4);
-			variant.get_child(vfilenames,    5);
-			variant.get_child(vposters,      6);
-			variant.get_child(vdates,        7);
-			variant.get_child(vspoilers,     8);
-			variant.get_child(vdeleted,      9);
-			variant.get_child(vhave_thumb,   10);
-			variant.get_child(vhave_image,   11);
-			std::vector<Glib::ustring> vec_boards = vboards    .get();
-			std::vector<Glib::ustring> vec_tags   = vtags      .get();
-			std::vector<std::string>   filenames  = vfilenames .get();
-			std::vector<std::string>   posters    = vposters   .get();
-			std::vector<gint64>        dates      = vdates     .get();
-			size                                  = vsize      .get();
-			md5                                   = vmd5       .get();
-			ext                                   = vext       .get();
-			num_spoiler                           = vspoilers  .get();
-			num_deleted                           = vdeleted   .get();
-			have_thumbnail                        = vhave_thumb.get();
-			have_image                            = vhave_image.get();
-			std::copy(vec_boards.rbegin(), vec_boards.rend(), std::inserter(boards,             boards            .begin()));
-			std::copy(vec_tags  .rbegin(), vec_tags  .rend(), std::inserter(tags,               tags              .begin()));
-			std::copy(filenames .rbegin(), filenames .rend(), std::inserter(original_filenames, original_filenames.begin()));
-			std::copy(posters   .rbegin(), posters   .rend(), std::inserter(poster_names,       poster_names      .begin()));
-			std::copy(dates     .rbegin(), dates     .rend(), std::inserter(posted_unix_dates,  posted_unix_dates .begin()));
-		} else {
-			g_error("Invalid version number for ImageCache data.");
-		}
-	}
-
 	ImageData::ImageData(const Glib::RefPtr<Post> &post) :
 		size(post->get_file_size()),
-		md5(post->get_hash()),
-		ext(post->get_image_ext()),
+		last_access(0),
+		thumb_size(0),
+		thumb_pack(0),
+		thumb_offset(0),
 		num_spoiler(post->is_spoiler()?1:0),
 		num_deleted(0),
 		have_thumbnail(false),
-		have_image(false)
+		have_image(false),
+		flags(0),
+		ext(IMAGE_EXT_JPG),
+		unusual_md5(0),
+		unusual_ext(0)
 	{
-		boards.insert             ( post->get_board() );
-		original_filenames.insert ( post->get_original_filename() );
-		poster_names.insert       ( post->get_name() + post->get_tripcode() );
-		posted_unix_dates.insert  ( post->get_unix_time() );
+		set_md5(post->get_hash());
+		set_ext(post->get_image_ext());
+		boards.insert       ( intern(post->get_board().c_str()) );
+		add_filename        ( post->get_original_filename() );
+		poster_names.insert ( intern((post->get_name() + post->get_tripcode()).c_str()) );
+		add_date            ( post->get_unix_time() );
+		add_dates_from_filename(post->get_original_filename());
+	}
+
+	void ImageData::set_md5(const std::string &md5) {
+		key = make_image_key(md5);
+		gchar *encoded = g_base64_encode(key.data(), key.size());
+		if (md5.compare(encoded) != 0)
+			unusual_md5 = intern(md5.c_str());
+		g_free(encoded);
+	}
+
+	std::string ImageData::get_md5() const {
+		if (G_UNLIKELY( unusual_md5 != 0 ))
+			return g_quark_to_string(unusual_md5);
 
-		gint64 id = g_ascii_strtoll(post->get_original_filename().c_str(), NULL, 10);
+		return image_key_to_md5(key);
+	}
+
+	void ImageData::set_ext(const std::string &extension) {
+		auto iter = std::find_if(known_exts.begin(), known_exts.end(),
+		                         [&extension](const gchar *known) {
+			                         return extension.compare(known) == 0; });
+		ext = static_cast<ImageExt>(iter - known_exts.begin());
+		if (ext == IMAGE_EXT_OTHER)
+			unusual_ext = intern(extension.c_str());
+	}
+
+	std::string ImageData::get_ext() const {
+		if (G_UNLIKELY( ext == IMAGE_EXT_OTHER ))
+			return g_quark_to_string(unusual_ext);
+
+		return known_exts[ext];
+	}
+
+	bool ImageData::add_filename(const std::string &filename) {
+		const gchar *names = original_filenames.c_str();
+		const gchar *end = names + original_filenames.size();
+		for (const gchar *name = names; name < end; name += std::strlen(name) + 1) {
+			if (filename.compare(name) == 0)
+				return false;
+		}
+
+		if (!original_filenames.empty())
+			original_filenames.push_back('\0');
+		original_filenames.append(filename.c_str());
+		return true;
+	}
+
+	bool ImageData::add_date(const gint64 date) {
+		return posted_unix_dates.insert(date);
+	}
+
+	/* Filenames are often the UNIX time the image was posted, in s or ms */
+	bool ImageData::add_dates_from_filename(const std::string &filename) {
+		gint64 id = g_ascii_strtoll(filename.c_str(), NULL, 10);
 		const gint64 now = Glib::DateTime::create_now_utc().to_unix();
 		if ( id > 1000000000 && id < now ) {
-			posted_unix_dates.insert ( id );
+			return add_date ( id );
 		} else {
 			id = id / 1000;
 			if ( id > 1000000000 && id < now ) {
-				posted_unix_dates.insert ( id );
+				return add_date ( id );
 			}
 		}
+
+		return false;
 	}
 
-	void ImageData::update(const Glib::RefPtr<Post> &post) {
-		if ( md5.find(post->get_hash()) == md5.npos ) {
+	bool ImageData::update(const Glib::RefPtr<Post> &post) {
+		if ( make_image_key(post->get_hash()) != key ) {
 			g_error("ImageData::update() called with invalid post. My hash = %s, post hash = %s.",
-			        md5.c_str(), post->get_hash().c_str());
+			        get_md5().c_str(), post->get_hash().c_str());
 		}
 
-		boards.insert            (post->get_board());
-		original_filenames.insert(post->get_original_filename());
-		poster_names.insert      (post->get_name() + post->get_tripcode());
-		auto pair = posted_unix_dates.insert (post->get_unix_time());
-		if (pair.second) {// We surely haven't seen this before
+		bool changed = false;
+		changed |= boards.insert       (intern(post->get_board().c_str()));
+		changed |= add_filename        (post->get_original_filename());
+		changed |= poster_names.insert (intern((post->get_name() + post->get_tripcode()).c_str()));
+		if (add_date(post->get_unix_time())) {// We surely haven't seen this before
+			changed = true;
 			if (post->is_spoiler())
 				num_spoiler++;
 			if (post->is_deleted()) // FIXME
 				num_deleted++;
 		}
 
-		gint64 id = g_ascii_strtoll(post->get_original_filename().c_str(), NULL, 10);
-		const gint64 now = Glib::DateTime::create_now_utc().to_unix();
-		if ( id > 1000000000 && id < now ) {
-			posted_unix_dates.insert ( id );
-		} else {
-			id = id / 1000;
-			if ( id > 1000000000 && id < now ) {
-				posted_unix_dates.insert ( id );
-			}
-		}
+		changed |= add_dates_from_filename(post->get_original_filename());
+
+		return changed;
 	}
 
 	void ImageData::merge(const std::unique_ptr<ImageData> &in) {
-		if ( md5.find(in->md5) == md5.npos ) {
+		if ( in->key != key ) {
 			g_warning("ImageData::merge() called with wrong hash. These shouldn't be merged!");
 			return;
 		}
@@ -217,90 +242,58 @@ namespace Horizon {
 		                          in->boards.end());
 		tags.insert              (in->tags.begin(),
 		                          in->tags.end());
-		original_filenames.insert(in->original_filenames.begin(),
-		                          in->original_filenames.end());
 		poster_names.insert      (in->poster_names.begin(),
 		                          in->poster_names.end());
 		posted_unix_dates.insert (in->posted_unix_dates.begin(),
 		                          in->posted_unix_dates.end());
+		const gchar *names = in->original_filenames.c_str();
+		const gchar *end = names + in->original_filenames.size();
+		for (const gchar *name = names; name < end; name += std::strlen(name) + 1)
+			add_filename(name);
+		if (!have_thumbnail && in->have_thumbnail) {
+			thumb_pack   = in->thumb_pack;
+			thumb_offset = in->thumb_offset;
+		}
 		num_spoiler   += in->num_spoiler;
 		num_deleted   += in->num_deleted;
 		have_thumbnail = have_thumbnail | in->have_thumbnail;
 		have_image     = have_image | in->have_image;
+		last_access    = std::max(last_access, in->last_access);
+		thumb_size     = std::max(thumb_size, in->thumb_size);
+		flags         |= in->flags;
 	}
 
 	/*
-	  This will lean in Gtk < 3.8
+	 * How recently the image was seen, posted or read, with each time
+	 * it was posted again counting as a day more recent.
 	 */
-	Glib::VariantContainerBase ImageData::get_variant() const {
-		auto vsize = Glib::Variant<guint64>::create(size);
-		auto vmd5 = Glib::Variant<std::string>::create(md5);
-		auto vext = Glib::Variant<std::string>::create(ext);
-		std::vector<Glib::ustring> vec_boards, vec_tags;
-		std::vector<std::string> filenames, posters;
-		std::vector<gint64> dates;
-		std::copy(boards            .begin(), boards            .end(), std::back_inserter(vec_boards));
-		std::copy(tags              .begin(), tags              .end(), std::back_inserter(vec_tags));
-		std::copy(original_filenames.begin(), original_filenames.end(), std::back_inserter(filenames));
-		std::copy(poster_names      .begin(), poster_names      .end(), std::back_inserter(posters));
-		std::copy(posted_unix_dates .begin(), posted_unix_dates .end(), std::back_inserter(dates));
-		auto vboards       = Glib::Variant< std::vector<Glib::ustring> >::create(vec_boards);
-		auto vtags         = Glib::Variant< std::vector<Glib::ustring> >::create(vec_tags);
-		auto vfilenames    = Glib::Variant< std::vector<std::string> >  ::create(filenames);
-		auto vposters      = Glib::Variant< std::vector<std::string> >  ::create(posters);
-		auto vdates        = Glib::Variant< std::vector<gint64> >       ::create(dates);
-		auto vspoilers     = Glib::Variant< guint16 >                   ::create(num_spoiler);
-		auto vdeleted      = Glib::Variant< guint16 >                   ::create(num_deleted);
-		auto vhave_thumb   = Glib::Variant< bool >                      ::create(have_thumbnail);
-		auto vhave_image   = Glib::Variant< bool >                      ::create(have_image);
-
-		return Glib::VariantContainerBase::create_tuple({
-				    vsize,          // 0
-					vmd5,           // 1
-					vext,           // 2
-					vboards,        // 3
-					vtags,          // 4
-					vfilenames,     // 5
-					vposters,       // 6
-					vdates,         // 7
-					vspoilers,      // 8
-					vdeleted,       // 9
-					vhave_thumb,    // 10
-					vhave_image});  // 11
+	static gint64 eviction_score(const gint64 last_access,
+	                             const gint64 *dates, const gsize n_dates) {
+		gint64 recency = last_access;
+		for (gsize i = 0; i < n_dates; i++)
+			recency = std::max(recency, dates[i]);
+
+		const gsize reposts = n_dates > 1 ? n_dates - 1 : 0;
+		return recency + CACHE_EVICTION_REPOST_BONUS * std::min<gsize>(reposts, CACHE_EVICTION_MAX_REPOSTS);
+	}
+
+	gint64 ImageData::get_eviction_score() const {
+		return eviction_score(last_access, posted_unix_dates.begin(), posted_unix_dates.size());
 	}
 
 	GVariant* ImageData::get_cvariant() const {
-		GVariantBuilder boards_builder, tags_builder, filenames_builder, posters_builder, dates_builder;
+		GVariantBuilder filenames_builder, dates_builder;
 		const std::unique_ptr<GVariantType, VariantTypeDeleter> dates_type(g_variant_type_new_array(G_VARIANT_TYPE_INT64));
-		g_variant_builder_init(&boards_builder,
-		                       G_VARIANT_TYPE_STRING_ARRAY);
-		g_variant_builder_init(&tags_builder,
-		                       G_VARIANT_TYPE_STRING_ARRAY);
 		g_variant_builder_init(&filenames_builder,
 		                       G_VARIANT_TYPE_BYTESTRING_ARRAY);
-		g_variant_builder_init(&posters_builder,
-		                       G_VARIANT_TYPE_BYTESTRING_ARRAY);
 		g_variant_builder_init(&dates_builder,
 		                       dates_type.get());
 
-		for ( auto board : boards ) {
-			g_variant_builder_add_value(&boards_builder,
-			                            g_variant_new_string(board.c_str()));
-		}
-
-		for ( auto tag : tags ) {
-			g_variant_builder_add_value(&tags_builder,
-			                            g_variant_new_string(tag.c_str()));
-		}
-
-		for ( auto filename : original_filenames ) {
+		const gchar *names = original_filenames.c_str();
+		const gchar *end = names + original_filenames.size();
+		for (const gchar *name = names; name < end; name += std::strlen(name) + 1) {
 			g_variant_builder_add_value(&filenames_builder,
-			                            g_variant_new_bytestring(filename.c_str()));
-		}
-
-		for ( auto poster : poster_names ) {
-			g_variant_builder_add_value(&posters_builder,
-			                            g_variant_new_bytestring(poster.c_str()));
+			                            g_variant_new_bytestring(name));
 		}
 
 		for ( auto date : posted_unix_dates ) {
@@ -308,18 +301,23 @@ namespace Horizon {
 			                            g_variant_new_int64(date));
 		}
 		
-		std::array<GVariant*, 12> varray{ {g_variant_new_uint64(size),
-					g_variant_new_bytestring(md5.c_str()),
-					g_variant_new_bytestring(ext.c_str()),
-					g_variant_builder_end(&boards_builder),
-					g_variant_builder_end(&tags_builder),
+		std::array<GVariant*, 17> varray{ {g_variant_new_uint64(size),
+					g_variant_new_bytestring(get_md5().c_str()),
+					g_variant_new_bytestring(get_ext().c_str()),
+					quarks_to_array(boards, false),
+					quarks_to_array(tags, false),
 					g_variant_builder_end(&filenames_builder),
-					g_variant_builder_end(&posters_builder),
+					quarks_to_array(poster_names, true),
 					g_variant_builder_end(&dates_builder),
 					g_variant_new_uint16(num_spoiler),
 					g_variant_new_uint16(num_deleted),
 					g_variant_new_boolean(have_thumbnail),
-					g_variant_new_boolean(have_image)} };
+					g_variant_new_boolean(have_image),
+					g_variant_new_int64(last_access),
+					g_variant_new_uint32(thumb_size),
+					g_variant_new_byte(flags),
+					g_variant_new_uint32(thumb_pack),
+					g_variant_new_uint32(thumb_offset)} };
 					
 		GVariant *cvariant = g_variant_new_tuple(varray.data(), varray.size());
 
@@ -336,13 +334,14 @@ namespace Horizon {
 		else
 			type = "images";
 
+		const std::string md5 = get_md5();
 		std::string subdir = Glib::uri_escape_string(md5.substr(0, 2));
 
 		std::string filename;
 		if (thumb)
 			filename = Glib::uri_escape_string(md5 + ".jpg");
 		else
-			filename = Glib::uri_escape_string(md5 + ext);
+			filename = Glib::uri_escape_string(md5 + get_ext());
 
 		auto base = Glib::get_user_data_dir();
 		std::vector<std::string> elements = {base, "horizon", type, subdir, filename};
@@ -357,68 +356,578 @@ namespace Horizon {
 		return ret;
 	}
 
-	bool ImageCache::has_thumb(const Glib::RefPtr<Post> &post) {
-		Glib::Threads::Mutex::Lock lock(map_lock);
-		auto iter = images.find( post->get_hash() );
-		if ( iter != images.end() &&
-		     iter->second->have_thumbnail ) {
+	ImageIndex::ImageIndex() :
+		mapped(nullptr),
+		index(nullptr),
+		n_entries(0)
+	{
+	}
+
+	ImageIndex::~ImageIndex() {
+		close();
+	}
+
+	bool ImageIndex::open(const std::string &path) {
+		close();
+
+		GError *error = nullptr;
+		GMappedFile *file = g_mapped_file_new(path.c_str(), FALSE, &error);
+		if (!file) {
+			if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+				std::cerr << "Error: Unable to map image cache " << path
+				          << ": " << error->message << std::endl;
+			}
+			g_error_free(error);
+			return false;
+		}
+
+		const gsize length = g_mapped_file_get_length(file);
+		guint32 version = 0;
+		if (length >= CACHE_FILE_HEADER)
+			std::memcpy(&version, g_mapped_file_get_contents(file), sizeof(guint32));
+		if (version != CACHE_FILE_VERSION) {
+			g_mapped_file_unref(file);
+			return false;
+		}
+
+		// The mapping is page aligned, so past the header the entries
+		// are aligned for GVariant and are used where they lie
+		GBytes *bytes = g_mapped_file_get_bytes(file);
+		GBytes *entries = g_bytes_new_from_bytes(bytes,
+		                                         CACHE_FILE_HEADER,
+		                                         length - CACHE_FILE_HEADER);
+		const std::unique_ptr<GVariantType, VariantTypeDeleter> type(g_variant_type_new(CACHE_VERSION_2_ARRAYTYPE));
+		index = g_variant_ref_sink(g_variant_new_from_bytes(type.get(), entries, FALSE));
+		g_bytes_unref(entries);
+		g_bytes_unref(bytes);
+
+		mapped = file;
+		n_entries = g_variant_n_children(index);
+		return true;
+	}
+
+	void ImageIndex::close() {
+		if (index)
+			g_variant_unref(index);
+		if (mapped)
+			g_mapped_file_unref(mapped);
+		index = nullptr;
+		mapped = nullptr;
+		n_entries = 0;
+	}
+
+	gsize ImageIndex::size() const {
+		return n_entries;
+	}
+
+	goffset ImageIndex::get_file_size() const {
+		return mapped ? g_mapped_file_get_length(mapped) : 0;
+	}
+
+	std::unique_ptr<GVariant, VariantUnrefer> ImageIndex::get(const gsize i) const {
+		return std::unique_ptr<GVariant, VariantUnrefer>(g_variant_get_child_value(index, i));
+	}
+
+	std::unique_ptr<GVariant, VariantUnrefer> ImageIndex::lookup(const std::string &md5) const {
+		gsize low = 0;
+		gsize high = n_entries;
+
+		while (low < high) {
+			const gsize mid = low + (high - low) / 2;
+			auto entry = get(mid);
+			const gchar *entry_md5 = nullptr;
+			g_variant_get_child(entry.get(), 1, "^&ay", &entry_md5);
+
+			const int cmp = std::strcmp(entry_md5, md5.c_str());
+			if (cmp == 0)
+				return entry;
+			else if (cmp < 0)
+				low = mid + 1;
+			else
+				high = mid;
+		}
+
+		return std::unique_ptr<GVariant, VariantUnrefer>();
+	}
+
+	ImageKey make_image_key(const std::string &md5) {
+		ImageKey key;
+		key.fill(0);
+
+		if (md5.size() == 24) {
+			gsize len = 0;
+			guchar *decoded = g_base64_decode(md5.c_str(), &len);
+			if (len == key.size()) {
+				std::memcpy(key.data(), decoded, key.size());
+				g_free(decoded);
+				return key;
+			}
+			g_free(decoded);
+		}
+
+		// Catalog proxies and the like; key them by a digest of the whole string
+		GChecksum *checksum = g_checksum_new(G_CHECKSUM_MD5);
+		gsize len = key.size();
+		g_checksum_update(checksum, reinterpret_cast<const guchar*>(md5.data()), md5.size());
+		g_checksum_get_digest(checksum, key.data(), &len);
+		g_checksum_free(checksum);
+		return key;
+	}
+
+	std::string image_key_to_md5(const ImageKey &key) {
+		gchar *encoded = g_base64_encode(key.data(), key.size());
+		std::string md5(encoded);
+		g_free(encoded);
+		return md5;
+	}
+
+	std::size_t ImageKeyHash::operator()(const ImageKey &key) const {
+		// The key is already an md5, so any part of it will do
+		std::size_t hash;
+		std::memcpy(&hash, key.data() + key.size() - sizeof(hash), sizeof(hash));
+		return hash;
+	}
+
+	static std::string pack_filename(const guint32 pack) {
+		gchar *name = g_strdup_printf("pack-%08x.dat", pack);
+		std::string filename(name);
+		g_free(name);
+		return filename;
+	}
+
+	ThumbnailPacks::ThumbnailPacks(const std::string &dir) :
+		directory(dir),
+		active(0)
+	{
+	}
+
+	ThumbnailPacks::~ThumbnailPacks() {
+		close();
+	}
+
+	void ThumbnailPacks::open() {
+		close();
+
+		try {
+			Glib::Dir dir(directory);
+			for (const std::string name : dir) {
+				guint32 pack = 0;
+				if (std::sscanf(name.c_str(), "pack-%8x.dat", &pack) != 1 ||
+				    pack == 0 || name.compare(pack_filename(pack)) != 0)
+					continue;
+
+				const std::string path = Glib::build_filename(directory, name);
+				auto info = Gio::File::create_for_path(path)->query_info(G_FILE_ATTRIBUTE_STANDARD_SIZE);
+				packs[pack] = {path, info->get_size(), nullptr};
+			}
+		} catch (Glib::FileError e) {
+			if (e.code() != Glib::FileError::NO_SUCH_ENTITY) {
+				std::cerr << "Error: Unable to list thumbnail packs: "
+				          << e.what() << std::endl;
+			}
+		} catch (Gio::Error e) {
+			std::cerr << "Error: Unable to list thumbnail packs: "
+			          << e.what() << std::endl;
+		}
+	}
+
+	void ThumbnailPacks::close() {
+		if (ostream) {
+			try {
+				ostream->close();
+			} catch (Gio::Error e) {
+			}
+			ostream.reset();
+		}
+
+		for (auto &pair : packs) {
+			if (pair.second.mapped)
+				g_mapped_file_unref(pair.second.mapped);
+		}
+		packs.clear();
+		active = 0;
+	}
+
+	/* Packs are only started, so a pack left torn by a crash stays sealed */
+	bool ThumbnailPacks::start_pack() {
+		ostream.reset();
+		active = 0;
+
+		const guint32 pack = packs.empty() ? 1 : packs.rbegin()->first + 1;
+		const std::string path = Glib::build_filename(directory, pack_filename(pack));
+		try {
+			g_mkdir_with_parents(directory.c_str(), 0700);
+			auto file = Gio::File::create_for_path(path);
+			auto stream = file->create();
+			// Known from here on, so a failed pack is never reused
+			Pack &created = packs[pack];
+			created = {path, 0, nullptr};
+			const std::array<guint32, 2> header{ {THUMB_PACK_MAGIC, THUMB_PACK_VERSION} };
+			gsize written = 0;
+			stream->write_all(header.data(), THUMB_PACK_HEADER, written);
+			created.size = written;
+			if (written < THUMB_PACK_HEADER)
+				return false;
+
+			ostream = stream;
+			active = pack;
 			return true;
+		} catch (Gio::Error e) {
+			std::cerr << "Error: Unable to start thumbnail pack " << path
+			          << ": " << e.what() << std::endl;
 		}
-		
+
 		return false;
 	}
 
-	bool ImageCache::has_image(const Glib::RefPtr<Post> &post) {
-		Glib::Threads::Mutex::Lock lock(map_lock);
-		auto iter = images.find( post->get_hash() );
-		if ( iter != images.end() &&
-		     iter->second->have_image ) {
-			return true;
+	bool ThumbnailPacks::append(const ImageKey &key,
+	                            const std::string &md5,
+	                            const guint8 *data,
+	                            const guint32 size,
+	                            PackLocation &location) {
+		const gsize record_header = THUMB_PACK_RECORD_HEADER + md5.size();
+		auto iter = packs.find(active);
+		if (!ostream || iter == packs.end() ||
+		    iter->second.size + static_cast<goffset>(record_header + size) > THUMB_PACK_SIZE) {
+			if (!start_pack())
+				return false;
+			iter = packs.find(active);
 		}
-		
+
+		Pack &pack = iter->second;
+		std::vector<guint8> header(record_header);
+		const std::array<guint32, 2> fields{ {THUMB_PACK_RECORD_MAGIC, size} };
+		const guint32 md5_size = static_cast<guint32>(md5.size());
+		guint8 *p = header.data();
+		std::memcpy(p, fields.data(), sizeof(fields));
+		p += sizeof(fields);
+		std::memcpy(p, key.data(), key.size());
+		p += key.size();
+		std::memcpy(p, &md5_size, sizeof(md5_size));
+		p += sizeof(md5_size);
+		std::memcpy(p, md5.data(), md5.size());
+
+		try {
+			gsize written = 0;
+			ostream->write_all(header.data(), header.size(), written);
+			pack.size += written;
+			if (written == header.size()) {
+				const PackLocation written_location{active, static_cast<guint32>(pack.size), size};
+				ostream->write_all(data, size, written);
+				pack.size += written;
+				if (written == size) {
+					location = written_location;
+					return true;
+				}
+			}
+		} catch (Gio::Error e) {
+			std::cerr << "Error: Unable to append to thumbnail pack "
+			          << pack.path << ": " << e.what() << std::endl;
+		}
+
+		// The pack ends in a torn record now, so the next append
+		// starts another
+		ostream.reset();
+		active = 0;
 		return false;
 	}
 
+	/* Maps the pack, again if it has grown past the last mapping */
+	const guint8* ThumbnailPacks::map(Pack &pack, const goffset needed) {
+		if (pack.mapped && static_cast<goffset>(g_mapped_file_get_length(pack.mapped)) < needed) {
+			g_mapped_file_unref(pack.mapped);
+			pack.mapped = nullptr;
+		}
+
+		if (!pack.mapped) {
+			GError *error = nullptr;
+			pack.mapped = g_mapped_file_new(pack.path.c_str(), FALSE, &error);
+			if (!pack.mapped) {
+				std::cerr << "Error: Unable to map thumbnail pack " << pack.path
+				          << ": " << error->message << std::endl;
+				g_error_free(error);
+				return nullptr;
+			}
+		}
+
+		if (static_cast<goffset>(g_mapped_file_get_length(pack.mapped)) < needed)
+			return nullptr;
+
+		return reinterpret_cast<const guint8*>(g_mapped_file_get_contents(pack.mapped));
+	}
+
+	const guint8* ThumbnailPacks::get(const PackLocation &location) {
+		auto iter = packs.find(location.pack);
+		if (iter == packs.end())
+			return nullptr;
+
+		const goffset end = static_cast<goffset>(location.offset) + location.size;
+		if (location.offset < THUMB_PACK_HEADER + THUMB_PACK_RECORD_HEADER ||
+		    end > iter->second.size)
+			return nullptr;
+
+		const guint8 *contents = map(iter->second, end);
+		return contents ? contents + location.offset : nullptr;
+	}
+
+	bool ThumbnailPacks::get_record(const guint32 pack,
+	                                const guint32 offset,
+	                                ImageKey &key,
+	                                std::string &md5,
+	                                PackLocation &location) {
+		auto iter = packs.find(pack);
+		if (iter == packs.end())
+			return false;
+
+		goffset header_end = static_cast<goffset>(offset) + THUMB_PACK_RECORD_HEADER;
+		if (offset < THUMB_PACK_HEADER || header_end > iter->second.size)
+			return false;
+
+		const guint8 *contents = map(iter->second, header_end);
+		if (!contents)
+			return false;
+
+		std::array<guint32, 2> fields;
+		std::memcpy(fields.data(), contents, sizeof(fields));
+		if (fields[0] != THUMB_PACK_MAGIC || fields[1] != THUMB_PACK_VERSION)
+			return false;
+
+		const guint8 *p = contents + offset;
+		std::memcpy(fields.data(), p, sizeof(fields));
+		p += sizeof(fields);
+		if (fields[0] != THUMB_PACK_RECORD_MAGIC)
+			return false;
+		std::memcpy(key.data(), p, key.size());
+		p += key.size();
+		guint32 md5_size = 0;
+		std::memcpy(&md5_size, p, sizeof(md5_size));
+
+		header_end += md5_size;
+		if (header_end + fields[1] > iter->second.size)
+			return false;
+		contents = map(iter->second, header_end);
+		if (!contents)
+			return false;
+		md5.assign(reinterpret_cast<const char*>(contents) + offset + THUMB_PACK_RECORD_HEADER,
+		           md5_size);
+		location = {pack, static_cast<guint32>(header_end), fields[1]};
+		return true;
+	}
+
+	std::vector<guint32> ThumbnailPacks::get_sealed() const {
+		std::vector<guint32> sealed;
+		for (const auto &pair : packs) {
+			if (pair.first != active)
+				sealed.push_back(pair.first);
+		}
+
+		return sealed;
+	}
+
+	goffset ThumbnailPacks::get_size(const guint32 pack) const {
+		auto iter = packs.find(pack);
+		return iter == packs.end() ? 0 : iter->second.size;
+	}
+
+	void ThumbnailPacks::remove(const guint32 pack) {
+		auto iter = packs.find(pack);
+		if (iter == packs.end() || pack == active)
+			return;
+
+		if (iter->second.mapped)
+			g_mapped_file_unref(iter->second.mapped);
+
+		try {
+			Gio::File::create_for_path(iter->second.path)->remove();
+		} catch (Gio::Error e) {
+			if (e.code() != Gio::Error::NOT_FOUND) {
+				std::cerr << "Error: Unable to remove thumbnail pack "
+				          << iter->second.path << ": " << e.what() << std::endl;
+			}
+		}
+
+		packs.erase(iter);
+	}
+
+	ImageShard& ImageCache::get_shard(const ImageKey &key) {
+		return shards[key[0] % shards.size()];
+	}
+
+	const ImageShard& ImageCache::get_shard(const ImageKey &key) const {
+		return shards[key[0] % shards.size()];
+	}
+
+	/* Called with the shard's lock held. Parses the index's entry for md5 */
+	std::unique_ptr<ImageData> ImageCache::load_entry(const ImageShard &shard,
+	                                                  const ImageKey &key,
+	                                                  const std::string &md5) const {
+		if (shard.deleted.count(key) > 0)
+			return std::unique_ptr<ImageData>();
+
+		auto entry = std::atomic_load(&index)->lookup(md5);
+		if (!entry)
+			return std::unique_ptr<ImageData>();
+
+		return std::unique_ptr<ImageData>(new ImageData(CACHE_ENTRY_VERSION, std::move(entry)));
+	}
+
+	/*
+	 * Called with the shard's writer lock held. The entry to change
+	 * for md5, moved out of the index if need be.
+	 */
+	ImageData* ImageCache::find_entry(ImageShard &shard,
+	                                  const ImageKey &key,
+	                                  const std::string &md5) {
+		auto iter = shard.images.find(key);
+		if (iter != shard.images.end())
+			return iter->second.get();
+
+		auto loaded = load_entry(shard, key, md5);
+		if (!loaded)
+			return nullptr;
+
+		ImageData *data = loaded.get();
+		shard.images.insert(std::make_pair(key, std::move(loaded)));
+		return data;
+	}
+
+	bool ImageCache::has_file(const std::string &md5, const bool thumb) const {
+		const ImageKey key = make_image_key(md5);
+		const ImageShard &shard = get_shard(key);
+		{
+			Glib::Threads::RWLock::ReaderLock lock(shard.lock);
+			auto iter = shard.images.find(key);
+			if (iter != shard.images.end())
+				return thumb ? iter->second->have_thumbnail : iter->second->have_image;
+
+			if (shard.deleted.count(key) > 0)
+				return false;
+		}
+
+		// Loaded after the shard was checked, see index
+		auto entry = std::atomic_load(&index)->lookup(md5);
+		if (!entry)
+			return false;
+
+		gboolean have = FALSE;
+		g_variant_get_child(entry.get(), thumb ? 10 : 11, "b", &have);
+		return have;
+	}
+
+	void ImageCache::mark_dirty(const std::string &md5) {
+		Glib::Threads::Mutex::Lock lock(dirty_lock);
+		dirty.insert(md5);
+	}
+
+	bool ImageCache::is_ready() const {
+		return ready.load(std::memory_order_acquire);
+	}
+
+	/* Called on main thread */
+	void ImageCache::on_ready_dispatched() {
+		signal_ready();
+	}
+
+	bool ImageCache::has_thumb(const Glib::RefPtr<Post> &post) {
+		return has_file(post->get_hash(), true);
+	}
+
+	bool ImageCache::has_image(const Glib::RefPtr<Post> &post) {
+		return has_file(post->get_hash(), false);
+	}
+
+	/* Everything left in the stream, which is already all in memory */
+	static std::vector<guint8> read_stream(const Glib::RefPtr<Gio::InputStream> &istream) {
+		constexpr gsize chunk = 16 * 1024;
+		std::vector<guint8> data;
+		gssize read_bytes = 0;
+		do {
+			const gsize old_size = data.size();
+			data.resize(old_size + chunk);
+			read_bytes = istream->read(data.data() + old_size, chunk);
+			data.resize(old_size + std::max<gssize>(read_bytes, 0));
+		} while (read_bytes > 0);
+		istream->close();
+
+		return data;
+	}
+
+	ImageData* ImageCache::find_or_add_entry(ImageShard &shard,
+	                                         const ImageKey &key,
+	                                         const Glib::RefPtr<Post> &post) {
+		ImageData *image_data = find_entry(shard, key, post->get_hash());
+		if ( image_data == nullptr ) {
+			std::unique_ptr<ImageData> ptr(new ImageData(post));
+			auto pair = shard.images.insert(std::make_pair(key, std::move(ptr)));
+			if (pair.second) {
+				image_data = pair.first->second.get();
+			} else {
+				g_error("Failed to insert new image data");
+			}
+		}
+
+		return image_data;
+	}
+
+	/*
+	 * Called on the cache thread. Thumbnails are appended to the
+	 * packs here, images are handed to the write lane.
+	 */
 	void ImageCache::write(const Glib::RefPtr<Post> &post,
 	                       Glib::RefPtr<Gio::MemoryInputStream> istream,
 	                       const bool write_thumb) {
+		const std::string md5 = post->get_hash();
+		const ImageKey key = make_image_key(md5);
 		if (write_thumb && has_thumb(post)) {
 			g_warning("write called for thumbnail when we already have a thumbnail");
 			return;
 		} else if ((!write_thumb) && has_image(post)) {
 			g_warning("write called for image when we already have an image");
 			return;
+		} else if ((!write_thumb) && images_being_written.count(key) > 0) {
+			g_warning("write called for image which is already being written");
+			return;
 		}
 
 		Glib::RefPtr<Gio::File> file;
-		bool write_error = false;
+		ImageShard &shard = get_shard(key);
 		{
-			Glib::Threads::Mutex::Lock lock(map_lock);
-			std::map<std::string, std::unique_ptr<ImageData> >::iterator image_data_iter;
-			auto iter = images.find(post->get_hash());
-			if ( iter == images.end() ) {
-				std::unique_ptr<ImageData> ptr(new ImageData(post));
-				auto pair = images.insert(std::make_pair(ptr->md5, std::move(ptr)));
-				if (pair.second) {
-					image_data_iter = pair.first;
-				} else {
-					g_error("Failed to insert new image data");
-				}
-			} else {
-				image_data_iter = iter;
-			}
-			file = Gio::File::create_for_uri(image_data_iter->second->get_uri(write_thumb));
+			Glib::Threads::RWLock::WriterLock lock(shard.lock);
+			ImageData *image_data = find_or_add_entry(shard, key, post);
+			if (!write_thumb)
+				file = Gio::File::create_for_uri(image_data->get_uri(write_thumb));
 		}
 
-		if (!file) {
-			std::cerr << "Error: Failed to build filename for image ";
-			if (write_thumb)
-				std::cerr << post->get_thumb_url() << std::endl;
-			else
-				std::cerr << post->get_image_url() << std::endl;
-			return;
+		if (write_thumb) {
+			std::vector<guint8> data;
+			try {
+				data = read_stream(istream);
+			} catch (Gio::Error e) {
+				std::cerr << "Error: Unable to read thumbnail "
+				          << post->get_thumb_url() << ": " << e.what() << std::endl;
+			}
+
+			PackLocation location{0, 0, 0};
+			if (!data.empty() &&
+			    packs.append(key, md5, data.data(), data.size(), location))
+				record_write(post, write_thumb, location, data.size());
+		} else if (!file) {
+			std::cerr << "Error: Failed to build filename for image "
+			          << post->get_image_url() << std::endl;
+		} else {
+			images_being_written.insert(key);
+			io_pool.push(IO_LANE_WRITE,
+			             std::bind(&ImageCache::write_image_file, this,
+			                       post, istream, file));
 		}
+	}
 
+	/* Called on the write lane */
+	void ImageCache::write_image_file(const Glib::RefPtr<Post> &post,
+	                                  Glib::RefPtr<Gio::MemoryInputStream> istream,
+	                                  const Glib::RefPtr<Gio::File> &file) {
+		bool write_error = false;
+		gssize written = 0;
 		try {
 			auto parent = file->get_parent();
 			try {
@@ -426,143 +935,161 @@ namespace Horizon {
 					parent->make_directory();
 			} catch (Gio::Error e) {
 			} // Ignore
-			
+
 			if ( file->query_exists() ) {
 				g_warning("Image already exists on disk: %s. Replacing, but this shouldn't happen.", file->get_uri().c_str());
-			} 
+			}
 
 			auto ostream = file->replace();
-			ostream->splice(istream, 
-			                Gio::OUTPUT_STREAM_SPLICE_CLOSE_TARGET |
-			                Gio::OUTPUT_STREAM_SPLICE_CLOSE_SOURCE);
+			written = ostream->splice(istream,
+			                          Gio::OUTPUT_STREAM_SPLICE_CLOSE_TARGET |
+			                          Gio::OUTPUT_STREAM_SPLICE_CLOSE_SOURCE);
 		} catch (Gio::Error e) {
 			std::cerr << "Error: Unable to save image ("
-			          << file->get_uri() << ") to disk: " 
+			          << file->get_uri() << ") to disk: "
 			          << e.what() << std::endl;
 			write_error = true;
 		}
 
-		if (!write_error) {
-			Glib::Threads::Mutex::Lock lock(map_lock);
-			auto iter = images.find(post->get_hash());
-			if (iter != images.end()) {
-				if (write_thumb)
-					iter->second->have_thumbnail = true;
-				else
-					iter->second->have_image = true;
-			}
+		{
+			Glib::Threads::Mutex::Lock lock(image_written_queue_lock);
+			image_written_queue.push_back({post, write_error ? -1 : written});
 		}
+
+		image_written_w.send();
 	}
 
-	void ImageCache::read_thumb(const Glib::RefPtr<Post> &post,
-	                            std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)> callback,
-	                            std::shared_ptr<Canceller> canceller) {
-		Glib::RefPtr<Gio::File> file;
-		constexpr bool is_thumb = true;
+	/* Called on the cache thread */
+	void ImageCache::finish_image_writes() {
+		std::deque< std::pair< Glib::RefPtr<Post>, gssize> > work_list;
+		{
+			Glib::Threads::Mutex::Lock lock(image_written_queue_lock);
+			work_list.swap(image_written_queue);
+		}
 
-		if (post) {
-			Glib::Threads::Mutex::Lock lock(map_lock);
-			auto iter = images.find(post->get_hash());
-			if ( iter == images.end() ) {
-				g_error("Read thumb called when we don't have the thumbnail");
-			} else {
-				if ( iter->second->have_thumbnail == false ) {
-					g_error("Read thumb called when we don't have the thumbnail");
-				} else {
-					if (G_LIKELY(iter->second)) {
-						iter->second->update(post);
-						file = Gio::File::create_for_uri(iter->second->get_uri(is_thumb));
-					} else {
-						g_error("An invalid image_data is in std::map images");
-					}
-				}
-			}
+		for (auto pair : work_list) {
+			images_being_written.erase(make_image_key(pair.first->get_hash()));
+			if (pair.second >= 0)
+				record_write(pair.first, false, {0, 0, 0}, pair.second);
 		}
+	}
 
-		if (file)
-			read(file, callback, canceller);
+	void ImageCache::on_image_written_w(ev::async &, int) {
+		finish_image_writes();
 	}
 
-	void ImageCache::read_image(const Glib::RefPtr<Post> &post,
-	                            std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)> callback,
-	                            std::shared_ptr<Canceller> canceller) {
-		Glib::RefPtr<Gio::File> file;
-		constexpr bool is_thumb = false;
+	/* Called on the cache thread once the bytes are on disk */
+	void ImageCache::record_write(const Glib::RefPtr<Post> &post,
+	                              const bool write_thumb,
+	                              const PackLocation &location,
+	                              const gssize written) {
+		const std::string md5 = post->get_hash();
+		const ImageKey key = make_image_key(md5);
+		ImageShard &shard = get_shard(key);
 		{
-			Glib::Threads::Mutex::Lock lock(map_lock);
-			auto iter = images.find(post->get_hash());
-			if ( iter == images.end() ) {
-				g_error("Read thumb called when we don't have the thumbnail");
+			Glib::Threads::RWLock::WriterLock lock(shard.lock);
+			// The entry may have been dropped as invalid while the
+			// image was on the write lane
+			ImageData *image_data = find_or_add_entry(shard, key, post);
+			if (write_thumb) {
+				image_data->have_thumbnail = true;
+				image_data->thumb_size = location.size;
+				image_data->thumb_pack = location.pack;
+				image_data->thumb_offset = location.offset;
+				// Catalog posts are proxies without a thread
+				if (post->get_thread_id() == 0)
+					image_data->set_catalog_thumbnail();
 			} else {
-				if (iter->second->have_image == false) {
-					g_error("Read thumb called when we don't have the thumbnail");
-				} else {
-					if (G_LIKELY(iter->second)) {
-						iter->second->update(post);
-						file = Gio::File::create_for_uri(iter->second->get_uri(is_thumb));
-					} else {
-						g_error("An invalid image_data is in std::map images");
-					}
-				}
+				image_data->have_image = true;
 			}
+			image_data->last_access = Glib::DateTime::create_now_utc().to_unix();
 		}
-		
-		if (file)
-			read(file, callback, canceller);
+		mark_dirty(md5);
+		bytes_since_eviction += std::max<gssize>(written, 0);
 	}
-	
-	void ImageCache::read(const Glib::RefPtr<Gio::File>& file,
-	                      std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)> callback,
-	                      std::shared_ptr<Canceller> canceller) {
+
+	/*
+	 * Updates what we know about the image from post, returning its
+	 * file, or for a packed thumbnail setting location instead. Index
+	 * entries that learn nothing are parsed but not kept.
+	 */
+	Glib::RefPtr<Gio::File> ImageCache::update_for_read(const Glib::RefPtr<Post> &post,
+	                                                    const bool is_thumb,
+	                                                    PackLocation &location) {
+		location = {0, 0, 0};
+		const std::string md5 = post->get_hash();
+		const ImageKey key = make_image_key(md5);
+		ImageShard &shard = get_shard(key);
+		Glib::Threads::RWLock::WriterLock lock(shard.lock);
+		ImageData *image_data = nullptr;
+		std::unique_ptr<ImageData> loaded;
+
+		auto iter = shard.images.find(key);
+		if (iter != shard.images.end()) {
+			image_data = iter->second.get();
+		} else {
+			loaded = load_entry(shard, key, md5);
+			image_data = loaded.get();
+		}
+
+		// It may have been evicted since the caller checked, in
+		// which case the empty file makes the caller download it
+		if ( image_data == nullptr ||
+		     !(is_thumb ? image_data->have_thumbnail : image_data->have_image) ) {
+			return Glib::RefPtr<Gio::File>();
+		}
+
+		Glib::RefPtr<Gio::File> file;
+		if (is_thumb)
+			location = image_data->get_thumb_location();
+		if (location.pack == 0)
+			file = Gio::File::create_for_uri(image_data->get_uri(is_thumb));
+		bool changed = image_data->update(post);
+		const gint64 now = Glib::DateTime::create_now_utc().to_unix();
+		if (now - image_data->last_access > CACHE_ACCESS_GRANULARITY) {
+			image_data->last_access = now;
+			changed = true;
+		}
+
+		if (changed) {
+			if (loaded)
+				shard.images.insert(std::make_pair(key, std::move(loaded)));
+			lock.release();
+			mark_dirty(md5);
+		}
+
+		return file;
+	}
+
+	/*
+	 * Feeds data to a new loader a chunk at a time, so anyone following
+	 * the loader sees the image as it decodes. Returns an empty RefPtr
+	 * if the data isn't an image.
+	 */
+	static Glib::RefPtr<Gdk::PixbufLoader> decode(const guint8 *data,
+	                                              const gsize size,
+	                                              const Glib::ustring &name,
+	                                              std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)> loader_created = nullptr) {
 		auto read_error = false;
 		auto loader = Gdk::PixbufLoader::create();
-		
-		if (file) {
-			try {
-				if ( !file->query_exists() ) {
-					g_warning("Cache believes it has %s on disk, but it doesn't exist.",
-					          file->get_uri().c_str());
-					read_error = true;
-				} else {
-					auto istream = file->read();
-					if (!istream->can_seek()) {
-						g_error("Filesystem holding cache does not allow seeks.");
-					}
-					istream->seek(0, Glib::SEEK_TYPE_END);
-					const gsize fsize = istream->tell();
-					istream->seek(0, Glib::SEEK_TYPE_SET);
-					std::unique_ptr<guint8[]> buffer(new guint8[fsize]);
-					gsize read_bytes = 0;
-					istream->read_all(buffer.get(), fsize, read_bytes);
-					if (read_bytes != fsize) {
-						std::cerr << "Warning: While reading "
-						          << file->get_uri() << " from disk, expected "
-						          << fsize << " bytes, but got " << read_bytes
-						          << std::endl;
-						read_error = true;
-					} else {
-						// BUG LEAK: gdk_pixbuf_loader_write() leaks
-						// randomly (but rarely)
-						loader->write(buffer.get(), read_bytes);
-					}
-					istream->close();
-				}
-			} catch (Gio::Error e) {
-				std::cerr << "Error reading image " << file->get_uri()
-				          << " from disk: " << e.what() << std::endl;
-				read_error = true;
-			} catch (Gdk::PixbufError e) {
-				std::cerr << "Error creating image from on-disk cache ("
-				          << file->get_uri() << ") : " << e.what()
-				          << std::endl;
-				read_error = true;
-			} catch (Glib::FileError e) {
-				std::cerr << "Error creating image from on-disk cache ("
-				          << file->get_uri() << ") : " << e.what()
-				          << std::endl;
-				read_error = true;
+		if (loader_created)
+			loader_created(loader);
+
+		try {
+			for (gsize offset = 0; offset < size; offset += CACHE_READ_CHUNK) {
+				// BUG LEAK: gdk_pixbuf_loader_write() leaks
+				// randomly (but rarely)
+				loader->write(data + offset, std::min(CACHE_READ_CHUNK, size - offset));
 			}
-		} else {
+		} catch (Gdk::PixbufError e) {
+			std::cerr << "Error creating image from on-disk cache ("
+			          << name << ") : " << e.what()
+			          << std::endl;
+			read_error = true;
+		} catch (Glib::FileError e) {
+			std::cerr << "Error creating image from on-disk cache ("
+			          << name << ") : " << e.what()
+			          << std::endl;
 			read_error = true;
 		}
 
@@ -582,11 +1109,149 @@ namespace Horizon {
 			}
 		}
 
-		if (read_error)
-			loader.reset(); // Deletes the loader
-
-		auto cb = std::bind(callback, loader);
-		canceller->involke_if_not_cancelled(cb);
+		if (read_error)
+			loader.reset(); // Deletes the loader
+
+		return loader;
+	}
+
+	void ImageCache::read_thumb(const Glib::RefPtr<Post> &post,
+	                            const Glib::RefPtr<Gio::File> &file,
+	                            const PackLocation &location,
+	                            std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)> callback,
+	                            std::shared_ptr<Canceller> canceller) {
+		Glib::RefPtr<Gdk::PixbufLoader> loader;
+
+		if (location.pack != 0) {
+			const guint8 *data = packs.get(location);
+			if (data) {
+				loader = decode(data, location.size, post->get_thumb_url());
+			} else {
+				std::cerr << "Error: Thumbnail pack " << location.pack
+				          << " doesn't hold " << post->get_thumb_url() << std::endl;
+			}
+		} else if (file) {
+			auto mapped = map_file(file);
+			if (mapped) {
+				const guint8 *data = reinterpret_cast<const guint8*>(g_mapped_file_get_contents(mapped.get()));
+				const gsize size = g_mapped_file_get_length(mapped.get());
+				loader = decode(data, size, file->get_uri());
+				if (loader)
+					move_to_pack(post->get_hash(), data, size, file);
+			}
+		}
+
+		if (!loader && (file || location.pack != 0))
+			forget_thumb(post->get_hash());
+
+		auto cb = std::bind(callback, loader);
+		canceller->involke_if_not_cancelled(cb);
+	}
+
+	/*
+	 * Copies a thumbnail saved before the packs into the session's
+	 * pack. Its file goes once the journal has the new location.
+	 */
+	void ImageCache::move_to_pack(const std::string &md5,
+	                              const guint8 *data,
+	                              const gsize size,
+	                              const Glib::RefPtr<Gio::File> &file) {
+		const ImageKey key = make_image_key(md5);
+		PackLocation location;
+		if (!packs.append(key, md5, data, size, location))
+			return;
+
+		ImageShard &shard = get_shard(key);
+		{
+			Glib::Threads::RWLock::WriterLock lock(shard.lock);
+			ImageData *image_data = find_entry(shard, key, md5);
+			if (image_data == nullptr || !image_data->have_thumbnail ||
+			    image_data->thumb_pack != 0)
+				return;
+
+			image_data->thumb_size = location.size;
+			image_data->thumb_pack = location.pack;
+			image_data->thumb_offset = location.offset;
+		}
+		mark_dirty(md5);
+		remove_after_flush.push_back(file);
+	}
+
+	/*
+	 * The thumbnail couldn't be read, so drop it and let the download
+	 * that follows write it again.
+	 */
+	void ImageCache::forget_thumb(const std::string &md5) {
+		const ImageKey key = make_image_key(md5);
+		ImageShard &shard = get_shard(key);
+		bool changed = false;
+		{
+			Glib::Threads::RWLock::WriterLock lock(shard.lock);
+			ImageData *image_data = find_entry(shard, key, md5);
+			if (image_data != nullptr && image_data->have_thumbnail) {
+				image_data->have_thumbnail = false;
+				changed = true;
+			}
+		}
+
+		if (changed)
+			mark_dirty(md5);
+	}
+
+	void ImageCache::read_image(const Glib::RefPtr<Post> &post,
+	                            std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)> callback,
+	                            std::shared_ptr<Canceller> canceller,
+	                            std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)> loader_created) {
+		Glib::RefPtr<Gio::File> file;
+		PackLocation location;
+		constexpr bool is_thumb = false;
+		file = update_for_read(post, is_thumb, location);
+		
+		io_pool.push(IO_LANE_READ,
+		             std::bind(&ImageCache::read, this,
+		                       file, callback, canceller, loader_created));
+	}
+	
+	/* Called on the read lane */
+	void ImageCache::read(const Glib::RefPtr<Gio::File>& file,
+	                      std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)> callback,
+	                      std::shared_ptr<Canceller> canceller,
+	                      std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)> loader_created) {
+		Glib::RefPtr<Gdk::PixbufLoader> loader;
+
+		if (file) {
+			auto mapped = map_file(file);
+			if (mapped) {
+				loader = decode(reinterpret_cast<const guint8*>(g_mapped_file_get_contents(mapped.get())),
+				                g_mapped_file_get_length(mapped.get()),
+				                file->get_uri(),
+				                loader_created);
+			}
+		}
+
+		auto cb = std::bind(callback, loader);
+		canceller->involke_if_not_cancelled(cb);
+	}
+
+	/*
+	 * Cached files are only ever replaced or unlinked, never
+	 * truncated, so a mapping stays valid for as long as we hold it.
+	 */
+	std::unique_ptr<GMappedFile, MappedFileUnrefer> ImageCache::map_file(const Glib::RefPtr<Gio::File>& file) {
+		GError *error = nullptr;
+		GMappedFile *mapped = g_mapped_file_new(file->get_path().c_str(), FALSE, &error);
+		if (!mapped) {
+			if (g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT)) {
+				g_warning("Cache believes it has %s on disk, but it doesn't exist.",
+				          file->get_uri().c_str());
+			} else {
+				std::cerr << "Error reading image " << file->get_uri()
+				          << " from disk: " << error->message << std::endl;
+			}
+			g_error_free(error);
+		}
+
+		return std::unique_ptr<GMappedFile, MappedFileUnrefer>(mapped);
 	}
 
 	void ImageCache::write_thumb_async(const Glib::RefPtr<Post> &post,
@@ -631,13 +1296,14 @@ namespace Horizon {
 
 	void ImageCache::get_image_async(const Glib::RefPtr<Post> &post,
 	                                 std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)> callback,
-	                                 std::shared_ptr<Canceller> canceller) {
+	                                 std::shared_ptr<Canceller> canceller,
+	                                 std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)> loader_created) {
 		if (G_UNLIKELY(!post))
 			g_error("Invalid post handed to get_thumb_async");
 
 		{
 			Glib::Threads::Mutex::Lock lock(image_read_queue_lock);
-			image_read_queue.push_back(std::make_tuple(post, callback, canceller));
+			image_read_queue.push_back(std::make_tuple(post, callback, canceller, loader_created));
 		}
 
 		read_queue_w.send();
@@ -657,32 +1323,63 @@ namespace Horizon {
 			thumb_read_queue.clear();
 		}
 
+		// Thumbnails are looked up first and read in pack order, so a
+		// thread's worth walks its packs front to back
+		struct ThumbRead {
+			Glib::RefPtr<Post> post;
+			Glib::RefPtr<Gio::File> file;
+			PackLocation location;
+			std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)> callback;
+			std::shared_ptr<Canceller> canceller;
+		};
+		std::vector<ThumbRead> thumb_reads;
+		thumb_reads.reserve(work_list.size());
 		for (auto pair : work_list) {
-			Glib::RefPtr<Post> post = std::get<0>(pair);
-			auto callback = std::get<1>(pair);
-			auto canceller = std::get<2>(pair);
-			read_thumb(post, callback, canceller);
+			ThumbRead thumb{std::get<0>(pair), Glib::RefPtr<Gio::File>(), {0, 0, 0},
+			                std::get<1>(pair), std::get<2>(pair)};
+			if (thumb.post)
+				thumb.file = update_for_read(thumb.post, true, thumb.location);
+			thumb_reads.push_back(std::move(thumb));
+		}
+
+		std::stable_sort(thumb_reads.begin(), thumb_reads.end(),
+		                 [](const ThumbRead &a, const ThumbRead &b) {
+			                 if (a.location.pack != b.location.pack)
+				                 return a.location.pack < b.location.pack;
+			                 return a.location.offset < b.location.offset;
+		                 });
+
+		for (const auto &thumb : thumb_reads) {
+			if (thumb.post) {
+				read_thumb(thumb.post, thumb.file, thumb.location,
+				           thumb.callback, thumb.canceller);
+			} else {
+				read(thumb.file, thumb.callback, thumb.canceller);
+			}
 		}
 
 		work_list.clear();
 		
+		std::vector< std::tuple< Glib::RefPtr<Post>,
+		                         std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)>,
+		                         std::shared_ptr<Canceller>,
+		                         std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)> > > image_work_list;
 		{
 			Glib::Threads::Mutex::Lock lock(image_read_queue_lock);
-			work_list.reserve(image_read_queue.size());
+			image_work_list.reserve(image_read_queue.size());
 			std::copy(image_read_queue.begin(),
 			          image_read_queue.end(),
-			          back_inserter(work_list));
+			          back_inserter(image_work_list));
 			image_read_queue.clear();
 		}
 
-		for (auto pair : work_list) {
-			Glib::RefPtr<Post> post = std::get<0>(pair);
-			auto callback = std::get<1>(pair);
-			auto canceller = std::get<2>(pair);
-			read_image(post, callback, canceller);
+		for (auto tuple : image_work_list) {
+			Glib::RefPtr<Post> post = std::get<0>(tuple);
+			auto callback = std::get<1>(tuple);
+			auto canceller = std::get<2>(tuple);
+			auto loader_created = std::get<3>(tuple);
+			read_image(post, callback, canceller, loader_created);
 		}
-
-		work_list.clear();
 	}
 
 	void ImageCache::on_write_queue_w(ev::async &, int) {
@@ -728,68 +1425,713 @@ namespace Horizon {
 
 	void ImageCache::on_flush_w(ev::async &, int) {
 		flush();
+		compact_if_needed();
+		start_eviction_if_needed();
+	}
+
+	void ImageCache::set_quotas(const guint64 thumbnails,
+	                            const guint64 images,
+	                            const guint64 catalog) {
+		quotas[CACHE_TIER_THUMBNAILS].store(thumbnails);
+		quotas[CACHE_TIER_IMAGES].store(images);
+		quotas[CACHE_TIER_CATALOG].store(catalog);
+		quotas_changed.store(true);
+		flush_w.send();
+	}
+
+	void ImageCache::pin(const std::string &md5) {
+		Glib::Threads::Mutex::Lock lock(pin_lock);
+		pins[make_image_key(md5)]++;
+	}
+
+	void ImageCache::unpin(const std::string &md5) {
+		Glib::Threads::Mutex::Lock lock(pin_lock);
+		auto iter = pins.find(make_image_key(md5));
+		if (iter != pins.end() && --iter->second == 0)
+			pins.erase(iter);
+	}
+
+	bool ImageCache::is_pinned(const ImageKey &key) const {
+		Glib::Threads::Mutex::Lock lock(pin_lock);
+		return pins.count(key) > 0;
+	}
+
+	/* Called on the cache thread. Starts a pass over from the beginning */
+	void ImageCache::start_eviction() {
+		quotas_changed.store(false);
+		bytes_since_eviction = 0;
+		eviction_index.reset();
+		eviction_shard_keys.clear();
+		std::vector<EvictionCandidate>().swap(eviction_candidates);
+		eviction_usage.fill(0);
+		eviction_pack_live.clear();
+		repack_queue.clear();
+		eviction_position = 0;
+		eviction_state = EVICTION_IDLE;
+
+		const bool has_quota = std::any_of(quotas.begin(), quotas.end(),
+		                                   [](const std::atomic<guint64> &quota) {
+			                                   return quota.load() > 0; });
+		if (!has_quota) {
+			idle_w.stop();
+			return;
+		}
+
+		eviction_index = std::atomic_load(&index);
+		eviction_state = EVICTION_SCAN_INDEX;
+		idle_w.start();
+	}
+
+	void ImageCache::start_eviction_if_needed() {
+		if (eviction_state != EVICTION_IDLE)
+			return;
+
+		if (quotas_changed.load() ||
+		    bytes_since_eviction > CACHE_EVICTION_INTERVAL_BYTES)
+			start_eviction();
+	}
+
+	void ImageCache::on_idle_w(ev::idle &w, int) {
+		if (!step_eviction())
+			w.stop();
+	}
+
+	void ImageCache::consider_for_eviction(const ImageKey &key,
+	                                       const std::string &md5,
+	                                       const gint64 score,
+	                                       const guint64 image_size,
+	                                       const guint32 thumb_size,
+	                                       const guint32 thumb_pack,
+	                                       const bool have_thumbnail,
+	                                       const bool have_image,
+	                                       const bool is_catalog) {
+		const bool pinned = is_pinned(key);
+
+		if (have_thumbnail) {
+			const CACHE_TIER tier = is_catalog ? CACHE_TIER_CATALOG : CACHE_TIER_THUMBNAILS;
+			const guint32 bytes = thumb_size > 0 ? thumb_size : CACHE_THUMB_SIZE_ESTIMATE;
+			eviction_usage[tier] += bytes;
+			if (thumb_pack != 0)
+				eviction_pack_live[thumb_pack] += bytes;
+			if (!pinned && quotas[tier].load() > 0)
+				eviction_candidates.push_back({score, key, md5, bytes, tier});
+		}
+
+		if (have_image) {
+			const guint32 bytes = static_cast<guint32>(std::min<guint64>(image_size, G_MAXUINT32));
+			eviction_usage[CACHE_TIER_IMAGES] += bytes;
+			if (!pinned && quotas[CACHE_TIER_IMAGES].load() > 0)
+				eviction_candidates.push_back({score, key, md5, bytes, CACHE_TIER_IMAGES});
+		}
+	}
+
+	bool ImageCache::step_eviction() {
+		typedef std::unique_ptr<GVariant, VariantUnrefer> v_ptr;
+
+		switch (eviction_state) {
+		case EVICTION_SCAN_INDEX: {
+			// A compaction moved everything we counted so far
+			if (std::atomic_load(&index) != eviction_index) {
+				start_eviction();
+				return eviction_state != EVICTION_IDLE;
+			}
+
+			const gsize end = std::min(eviction_position + CACHE_EVICTION_SCAN_CHUNK,
+			                           eviction_index->size());
+			for (; eviction_position < end; eviction_position++) {
+				const v_ptr entry = eviction_index->get(eviction_position);
+				const gchar *md5 = nullptr;
+				g_variant_get_child(entry.get(), 1, "^&ay", &md5);
+				const ImageKey key = make_image_key(md5);
+				const ImageShard &shard = get_shard(key);
+				{
+					// Changed entries are scanned with the shards
+					Glib::Threads::RWLock::ReaderLock lock(shard.lock);
+					if (shard.images.count(key) > 0 || shard.deleted.count(key) > 0)
+						continue;
+				}
+
+				guint64 image_size = 0;
+				gint64 last_access = 0;
+				guint32 thumb_size = 0;
+				guint32 thumb_pack = 0;
+				guint8 flags = 0;
+				gboolean have_thumbnail = FALSE;
+				gboolean have_image = FALSE;
+				g_variant_get_child(entry.get(), 0,  "t", &image_size);
+				g_variant_get_child(entry.get(), 10, "b", &have_thumbnail);
+				g_variant_get_child(entry.get(), 11, "b", &have_image);
+				g_variant_get_child(entry.get(), 12, "x", &last_access);
+				g_variant_get_child(entry.get(), 13, "u", &thumb_size);
+				g_variant_get_child(entry.get(), 14, "y", &flags);
+				g_variant_get_child(entry.get(), 15, "u", &thumb_pack);
+				const v_ptr vdates(g_variant_get_child_value(entry.get(), 7));
+				gsize n_dates = 0;
+				const gint64 *dates = static_cast<const gint64*>(g_variant_get_fixed_array(vdates.get(), &n_dates, sizeof(gint64)));
+
+				consider_for_eviction(key, md5,
+				                      eviction_score(last_access, dates, n_dates),
+				                      image_size, thumb_size, thumb_pack,
+				                      have_thumbnail, have_image,
+				                      flags & IMAGE_FLAG_CATALOG);
+			}
+
+			if (eviction_position == eviction_index->size()) {
+				eviction_index.reset();
+				for (const auto &shard : shards) {
+					Glib::Threads::RWLock::ReaderLock lock(shard.lock);
+					for (const auto &pair : shard.images)
+						eviction_shard_keys.push_back(pair.first);
+				}
+				eviction_position = 0;
+				eviction_state = EVICTION_SCAN_SHARDS;
+			}
+			return true;
+		}
+
+		case EVICTION_SCAN_SHARDS: {
+			const gsize end = std::min(eviction_position + CACHE_EVICTION_SCAN_CHUNK,
+			                           eviction_shard_keys.size());
+			for (; eviction_position < end; eviction_position++) {
+				const ImageKey &key = eviction_shard_keys[eviction_position];
+				const ImageShard &shard = get_shard(key);
+				Glib::Threads::RWLock::ReaderLock lock(shard.lock);
+				auto iter = shard.images.find(key);
+				if (iter == shard.images.end())
+					continue;
+
+				const ImageData *image_data = iter->second.get();
+				consider_for_eviction(key, image_data->get_md5(),
+				                      image_data->get_eviction_score(),
+				                      image_data->size,
+				                      image_data->thumb_size,
+				                      image_data->thumb_pack,
+				                      image_data->have_thumbnail,
+				                      image_data->have_image,
+				                      image_data->is_catalog_thumbnail());
+			}
+
+			if (eviction_position == eviction_shard_keys.size()) {
+				std::vector<ImageKey>().swap(eviction_shard_keys);
+
+				bool over_quota = false;
+				for (gsize tier = 0; tier < CACHE_TIER_COUNT; tier++) {
+					const guint64 quota = quotas[tier].load();
+					over_quota |= quota > 0 && eviction_usage[tier] > quota;
+				}
+
+				if (!over_quota) {
+					std::vector<EvictionCandidate>().swap(eviction_candidates);
+					eviction_state = EVICTION_IDLE;
+					return start_repack();
+				}
+
+				std::sort(eviction_candidates.begin(), eviction_candidates.end(),
+				          [](const EvictionCandidate &a, const EvictionCandidate &b) {
+					          return a.score < b.score; });
+				eviction_position = 0;
+				eviction_state = EVICTION_DELETE;
+			}
+			return true;
+		}
+
+		case EVICTION_DELETE: {
+			gsize evicted = 0;
+			for (; eviction_position < eviction_candidates.size() &&
+			       evicted < CACHE_EVICTION_DELETE_CHUNK; eviction_position++) {
+				const EvictionCandidate &candidate = eviction_candidates[eviction_position];
+				const guint64 quota = quotas[candidate.tier].load();
+				guint64 &usage = eviction_usage[candidate.tier];
+				if (quota == 0 || usage <= quota * CACHE_EVICTION_LOW_WATER)
+					continue;
+
+				if (evict(candidate)) {
+					usage -= std::min<guint64>(usage, candidate.bytes);
+					evicted++;
+				}
+			}
+
+			if (eviction_position == eviction_candidates.size()) {
+				std::cout << "Info: Image cache eviction done. Using "
+				          << eviction_usage[CACHE_TIER_THUMBNAILS] / 1024 << " KiB of thumbnails, "
+				          << eviction_usage[CACHE_TIER_CATALOG] / 1024 << " KiB of catalog thumbnails and "
+				          << eviction_usage[CACHE_TIER_IMAGES] / 1024 << " KiB of images."
+				          << std::endl;
+				std::vector<EvictionCandidate>().swap(eviction_candidates);
+				eviction_state = EVICTION_IDLE;
+				return start_repack();
+			}
+			return true;
+		}
+
+		case EVICTION_REPACK: {
+			for (gsize i = 0; i < THUMB_PACK_REPACK_CHUNK; i++) {
+				const REPACK_RESULT result = repack_record();
+				if (result == REPACK_NEXT)
+					continue;
+
+				if (result == REPACK_FAILED) {
+					// Whatever was copied stays where it was copied to
+					repack_queue.clear();
+				} else {
+					packs_after_flush.push_back(repack_queue.front());
+					repack_queue.erase(repack_queue.begin());
+					repack_offset = THUMB_PACK_HEADER;
+				}
+
+				if (repack_queue.empty()) {
+					std::cout << "Info: Repacked " << packs_after_flush.size()
+					          << " thumbnail packs." << std::endl;
+					// The packs go once the journal points past them
+					flush();
+					eviction_state = EVICTION_IDLE;
+					return false;
+				}
+			}
+			return true;
+		}
+
+		case EVICTION_IDLE:
+		default:
+			return false;
+		}
+	}
+
+	/*
+	 * Called on the cache thread once eviction is done. Queues the
+	 * packs that are mostly dead, or small enough to merge.
+	 */
+	bool ImageCache::start_repack() {
+		repack_queue.clear();
+		repack_offset = THUMB_PACK_HEADER;
+		for (const guint32 pack : packs.get_sealed()) {
+			const goffset size = packs.get_size(pack);
+			auto iter = eviction_pack_live.find(pack);
+			const guint64 live = iter == eviction_pack_live.end() ? 0 : iter->second;
+			if (size < THUMB_PACK_MERGE_SIZE || static_cast<goffset>(live * 2) < size)
+				repack_queue.push_back(pack);
+		}
+		std::map<guint32, guint64>().swap(eviction_pack_live);
+
+		if (repack_queue.empty())
+			return false;
+
+		eviction_state = EVICTION_REPACK;
+		return true;
+	}
+
+	/*
+	 * Copies the record at repack_offset into the session's pack if
+	 * its entry still points at it.
+	 */
+	ImageCache::REPACK_RESULT ImageCache::repack_record() {
+		const guint32 pack = repack_queue.front();
+		ImageKey key;
+		std::string md5;
+		PackLocation location;
+		if (!packs.get_record(pack, repack_offset, key, md5, location))
+			return REPACK_PACK_DONE;
+		repack_offset = location.offset + location.size;
+
+		ImageShard &shard = get_shard(key);
+		bool live = false;
+		{
+			Glib::Threads::RWLock::ReaderLock lock(shard.lock);
+			std::unique_ptr<ImageData> loaded;
+			const ImageData *image_data = nullptr;
+			auto iter = shard.images.find(key);
+			if (iter != shard.images.end()) {
+				image_data = iter->second.get();
+			} else {
+				loaded = load_entry(shard, key, md5);
+				image_data = loaded.get();
+			}
+			live = image_data != nullptr && image_data->have_thumbnail &&
+				image_data->thumb_pack == pack &&
+				image_data->thumb_offset == location.offset;
+		}
+
+		if (!live)
+			return REPACK_NEXT;
+
+		const guint8 *data = packs.get(location);
+		PackLocation moved;
+		if (data == nullptr || !packs.append(key, md5, data, location.size, moved))
+			return REPACK_FAILED;
+
+		bool changed = false;
+		{
+			Glib::Threads::RWLock::WriterLock lock(shard.lock);
+			ImageData *image_data = find_entry(shard, key, md5);
+			if (image_data != nullptr && image_data->thumb_pack == pack &&
+			    image_data->thumb_offset == location.offset) {
+				image_data->thumb_pack = moved.pack;
+				image_data->thumb_offset = moved.offset;
+				changed = true;
+			}
+		}
+		if (changed)
+			mark_dirty(md5);
+
+		return REPACK_NEXT;
+	}
+
+	/*
+	 * Deletes the candidate's file. The entry stops claiming the file
+	 * before it goes, and is dropped by clean_invalid() once it has
+	 * neither.
+	 */
+	bool ImageCache::evict(const EvictionCandidate &candidate) {
+		const std::string &md5 = candidate.md5;
+		const bool is_thumb = candidate.tier != CACHE_TIER_IMAGES;
+		ImageShard &shard = get_shard(candidate.key);
+		Glib::RefPtr<Gio::File> file;
+		guint32 pack = 0;
+		{
+			Glib::Threads::RWLock::WriterLock lock(shard.lock);
+			if (is_pinned(candidate.key))
+				return false;
+
+			ImageData *image_data = find_entry(shard, candidate.key, md5);
+			if (image_data == nullptr)
+				return false;
+
+			bool &have = is_thumb ? image_data->have_thumbnail : image_data->have_image;
+			if (!have)
+				return false;
+
+			if (is_thumb && image_data->thumb_pack != 0)
+				pack = image_data->thumb_pack;
+			else
+				file = Gio::File::create_for_uri(image_data->get_uri(is_thumb));
+			have = false;
+		}
+		mark_dirty(md5);
+
+		// Packed bytes are reclaimed when their pack is repacked
+		if (pack != 0) {
+			auto iter = eviction_pack_live.find(pack);
+			if (iter != eviction_pack_live.end())
+				iter->second -= std::min<guint64>(iter->second, candidate.bytes);
+			return true;
+		}
+
+		try {
+			file->remove();
+		} catch (Gio::Error e) {
+			if (e.code() != Gio::Error::NOT_FOUND) {
+				std::cerr << "Error: Unable to evict " << file->get_uri()
+				          << " from the image cache: " << e.what() << std::endl;
+			}
+		}
+
+		return true;
 	}
 
 	void ImageCache::clean_invalid() {
-		Glib::Threads::Mutex::Lock lock(map_lock);
-		auto iter = images.begin();
-		while (iter != images.end()) {
-			iter = std::find_if(images.begin(),
-			                    images.end(),
-			                    [](const std::pair<const std::string&, const std::unique_ptr<ImageData>& >& pair) {
-				                    return !(pair.second->have_image || pair.second->have_thumbnail);});
-			if ( iter != images.end() ) {
-				std::cerr << "Info: Deleting invalid image cache entry..." << std::endl;
-				images.erase(iter);
+		std::vector<std::string> invalid;
+		for (auto &shard : shards) {
+			Glib::Threads::RWLock::WriterLock lock(shard.lock);
+			auto iter = shard.images.begin();
+			while (iter != shard.images.end()) {
+				if (!(iter->second->have_image || iter->second->have_thumbnail)) {
+					std::cerr << "Info: Deleting invalid image cache entry..." << std::endl;
+					invalid.push_back(iter->second->get_md5());
+					shard.deleted.insert(iter->first);
+					iter = shard.images.erase(iter);
+				} else {
+					++iter;
+				}
 			}
-		}				              
+		}
+
+		Glib::Threads::Mutex::Lock lock(dirty_lock);
+		for (auto md5 : invalid) {
+			removed.insert(md5);
+			dirty.erase(md5);
+		}
+	}
+
+	static guint32 journal_checksum(const guint8 *data, const gsize size) {
+		guint32 hash = 2166136261u;
+		for (gsize i = 0; i < size; i++)
+			hash = (hash ^ data[i]) * 16777619u;
+
+		return hash;
+	}
+
+	static GVariant* make_journal_record(const std::string &md5, GVariant *cvariant) {
+		const std::unique_ptr<GVariantType, VariantTypeDeleter> type(g_variant_type_new(CACHE_VERSION_2_TYPE));
+		std::array<GVariant*, 2> children{ {g_variant_new_bytestring(md5.c_str()),
+					g_variant_new_maybe(type.get(), cvariant)} };
+
+		return g_variant_ref_sink(g_variant_new_tuple(children.data(), children.size()));
 	}
 
 	void ImageCache::flush() {
 		clean_invalid();
-		std::cout << "Info: Flushing..." << std::flush;
-		std::vector<GVariant*> cvariants;
+		std::set<std::string> flush_dirty;
+		std::set<std::string> flush_removed;
 		{
-			std::cout << " (locking)" << std::flush;
-			Glib::Threads::Mutex::Lock lock(map_lock);
-			cvariants.reserve(images.size());
-
-			std::transform(images.begin(),
-			               images.end(),
-			               std::back_inserter(cvariants),
-			               // pair.second->get_cvariant()
-			               std::bind(std::mem_fn(&ImageData::get_cvariant),
-			                         std::bind(std::mem_fn(&std::pair<const std::string,
-			                                               std::unique_ptr<ImageData> >::second),
-			                                   std::placeholders::_1))
-			               );
-		}
-		std::cout << " (unlocked)" << std::flush;
+			Glib::Threads::Mutex::Lock lock(dirty_lock);
+			flush_dirty.swap(dirty);
+			flush_removed.swap(removed);
+		}
 
-		if (cvariants.size() > 0) {
-			// do not free vt
-			const GVariantType * const vt = g_variant_get_type(cvariants.front());
+		std::vector<GVariant*> records;
+		records.reserve(flush_dirty.size() + flush_removed.size());
 
-			typedef std::unique_ptr<GVariant, VariantUnrefer> v_ptr;
+		for (auto md5 : flush_removed)
+			records.push_back(make_journal_record(md5, nullptr));
+
+		for (auto md5 : flush_dirty) {
+			const ImageKey key = make_image_key(md5);
+			const ImageShard &shard = get_shard(key);
+			Glib::Threads::RWLock::ReaderLock lock(shard.lock);
+			auto iter = shard.images.find(key);
+			if (iter != shard.images.end())
+				records.push_back(make_journal_record(md5, iter->second->get_cvariant()));
+		}
+
+		bool journaled = true;
+		if (records.size() > 0)
+			journaled = append_to_journal(records);
+
+		for (auto record : records)
+			g_variant_unref(record);
+
+		if (!journaled)
+			return;
+
+		// Nothing in the journal points at these any more
+		for (auto file : remove_after_flush) {
+			try {
+				file->remove();
+			} catch (Gio::Error e) {
+				if (e.code() != Gio::Error::NOT_FOUND) {
+					std::cerr << "Error: Unable to remove " << file->get_uri()
+					          << " from the image cache: " << e.what() << std::endl;
+				}
+			}
+		}
+		remove_after_flush.clear();
+
+		for (auto pack : packs_after_flush)
+			packs.remove(pack);
+		packs_after_flush.clear();
+	}
+
+	bool ImageCache::append_to_journal(const std::vector<GVariant*> &records) {
+		try {
+			auto ostream = journal_file->append_to();
+			gsize written = 0;
+
+			if (journal_size == 0) {
+				ostream->write_all(&CACHE_JOURNAL_VERSION, sizeof(guint32), written);
+				journal_size += written;
+			}
+
+			for (auto record : records) {
+				const gsize size = g_variant_get_size(record);
+				const std::unique_ptr<guint8[]> data(new guint8[size]);
+				g_variant_store(record, data.get());
+
+				const std::array<guint32, 2> header{ {static_cast<guint32>(size),
+							journal_checksum(data.get(), size)} };
+				ostream->write_all(header.data(), sizeof(header), written);
+				journal_size += written;
+				ostream->write_all(data.get(), size, written);
+				journal_size += written;
+			}
+
+			ostream->close();
+		} catch (Gio::Error e) {
+			std::cerr << "Error: Unable to append to image cache journal: "
+			          << e.what() << std::endl;
+			return false;
+		}
+
+		return true;
+	}
+
+	/*
+	 * Applies the journal on top of what was read from the cache
+	 * file. A torn or corrupt record ends the replay, and valid_end
+	 * is left where the records before it end.
+	 */
+	guint32 ImageCache::replay_journal(goffset &valid_end) {
+		valid_end = 0;
+		std::string contents;
+		try {
+			contents = Glib::file_get_contents(journal_file->get_path());
+		} catch (Glib::FileError e) {
+			if (e.code() != Glib::FileError::NO_SUCH_ENTITY) {
+				std::cerr << "Error: Unable to read image cache journal: "
+				          << e.what() << std::endl;
+			}
+			return 0;
+		}
+
+		journal_size = contents.size();
+		guint32 version = 0;
+		if (contents.size() < sizeof(guint32))
+			return 0;
+		std::memcpy(&version, contents.data(), sizeof(guint32));
+		if (version != CACHE_JOURNAL_VERSION) {
+			std::cerr << "Error: Unsupported image cache journal version "
+			          << version << std::endl;
+			// Compaction replaces it, so keep it whole until then
+			valid_end = journal_size;
+			return version;
+		}
+
+		typedef std::unique_ptr<GVariantType, VariantTypeDeleter> vtype_ptr;
+		typedef std::unique_ptr<GVariant, VariantUnrefer> v_ptr;
+		const vtype_ptr type(g_variant_type_new(CACHE_JOURNAL_RECORD_TYPE));
+		gsize pos = sizeof(guint32);
+		gsize replayed = 0;
+		valid_end = pos;
+
+		while (pos + 2 * sizeof(guint32) <= contents.size()) {
+			std::array<guint32, 2> header;
+			std::memcpy(header.data(), contents.data() + pos, sizeof(header));
+			const gsize size = header[0];
+			const guint8 *payload = reinterpret_cast<const guint8*>(contents.data() + pos + sizeof(header));
+			if (size > contents.size() - pos - sizeof(header) ||
+			    journal_checksum(payload, size) != header[1]) {
+				std::cerr << "Warning: Image cache journal ends with a damaged record"
+				          << std::endl;
+				break;
+			}
+			pos += sizeof(header) + size;
+			valid_end = pos;
+
+			// GVariant wants its data aligned
+			gpointer data = g_memdup(payload, size);
+			const v_ptr untrusted(g_variant_ref_sink(g_variant_new_from_data(type.get(), data, size,
+			                                                                 FALSE, g_free, data)));
+			const v_ptr record(g_variant_get_normal_form(untrusted.get()));
+
+			const gchar *md5 = nullptr;
+			g_variant_get_child(record.get(), 0, "^&ay", &md5);
+			const v_ptr maybe(g_variant_get_child_value(record.get(), 1));
+			v_ptr child(g_variant_get_maybe(maybe.get()));
+			const ImageKey key = make_image_key(md5);
+			ImageShard &shard = get_shard(key);
+			Glib::Threads::RWLock::WriterLock lock(shard.lock);
+			if (child) {
+				std::unique_ptr<ImageData> cp(new ImageData(CACHE_ENTRY_VERSION, std::move(child)));
+				shard.images[key] = std::move(cp);
+				shard.deleted.erase(key);
+			} else {
+				shard.images.erase(key);
+				shard.deleted.insert(key);
+			}
+			replayed++;
+		}
+
+		if (replayed > 0) {
+			std::cout << "Info: Replayed " << replayed
+			          << " image cache journal records." << std::endl;
+		}
+
+		return version;
+	}
+
+	bool ImageCache::truncate_journal(const goffset size) {
+		try {
+			auto iostream = journal_file->open_readwrite();
+			iostream->truncate(size);
+			iostream->close();
+		} catch (Gio::Error e) {
+			std::cerr << "Error: Unable to truncate image cache journal: "
+			          << e.what() << std::endl;
+			return false;
+		}
+
+		journal_size = size;
+		return true;
+	}
+
+	/*
+	 * Rewrites the whole cache file from the mapped index and what
+	 * changed since, empties the journal and maps the new file. Runs
+	 * on the ImageCache thread.
+	 */
+	void ImageCache::compact() {
+		flush();
+		std::cout << "Info: Compacting image cache..." << std::flush;
+
+		typedef std::unique_ptr<GVariant, VariantUnrefer> v_ptr;
+		// Index entries are referenced, not floating, so they are
+		// kept alive here until the array is built
+		std::vector<v_ptr> index_entries;
+		std::vector<GVariant*> cvariants;
+		{
+			std::map<std::string, GVariant*> changed;
+			std::unordered_set<ImageKey, ImageKeyHash> deleted;
+			for (const auto &shard : shards) {
+				Glib::Threads::RWLock::ReaderLock lock(shard.lock);
+				for (const auto &pair : shard.images)
+					changed.insert(std::make_pair(pair.second->get_md5(), pair.second->get_cvariant()));
+				deleted.insert(shard.deleted.begin(), shard.deleted.end());
+			}
+
+			const auto old_index = std::atomic_load(&index);
+			index_entries.reserve(old_index->size());
+			cvariants.reserve(old_index->size() + changed.size());
+
+			// Both sides are sorted by md5, so merging them keeps the
+			// new file sorted for lookups
+			auto iter = changed.begin();
+			for (gsize i = 0; i < old_index->size(); i++) {
+				v_ptr entry = old_index->get(i);
+				const gchar *md5 = nullptr;
+				g_variant_get_child(entry.get(), 1, "^&ay", &md5);
+
+				for (; iter != changed.end() && iter->first.compare(md5) < 0; ++iter)
+					cvariants.push_back(iter->second);
+
+				if (iter != changed.end() && iter->first.compare(md5) == 0) {
+					cvariants.push_back(iter->second);
+					++iter;
+				} else if (deleted.count(make_image_key(md5)) == 0) {
+					cvariants.push_back(entry.get());
+					index_entries.push_back(std::move(entry));
+				}
+			}
+			for (; iter != changed.end(); ++iter)
+				cvariants.push_back(iter->second);
+		}
 
+		gsize data_size = 0;
+		std::unique_ptr<guint8[]> data;
+		if (cvariants.size() > 0) {
+			const std::unique_ptr<GVariantType, VariantTypeDeleter> vt(g_variant_type_new(CACHE_VERSION_2_TYPE));
 			const v_ptr varray(g_variant_ref_sink(
-			                   g_variant_new_array(vt,
+			                   g_variant_new_array(vt.get(),
 			                                       cvariants.data(),
 			                                       cvariants.size())));
-			const gsize data_size = g_variant_get_size(varray.get());
-			const std::unique_ptr<guint8[]> data(new guint8[data_size]);
+			data_size = g_variant_get_size(varray.get());
+			data.reset(new guint8[data_size]);
 			g_variant_store(varray.get(), data.get());
-		
-			try {
-				const std::string etag;
-				constexpr bool make_backup = true;
-				constexpr Gio::FileCreateFlags fcflags = Gio::FILE_CREATE_NONE;
-				auto ostream = cache_file->replace(etag, make_backup, fcflags);
-				gsize written = 0;
-				ostream->write_all(&CACHE_FILE_VERSION, sizeof(guint32), written);
-				if ( written < sizeof(guint32) ) {
-					g_error("Unable to write version information");
-				}
+		}
+		index_entries.clear();
+
+		// Written even when empty, or removals in the journal would be
+		// lost when it is truncated
+		try {
+			const std::string etag;
+			constexpr bool make_backup = true;
+			constexpr Gio::FileCreateFlags fcflags = Gio::FILE_CREATE_NONE;
+			auto ostream = cache_file->replace(etag, make_backup, fcflags);
+			gsize written = 0;
+			const std::array<guint32, 2> header{ {CACHE_FILE_VERSION, 0} };
+			ostream->write_all(header.data(), CACHE_FILE_HEADER, written);
+			if ( written < CACHE_FILE_HEADER ) {
+				g_error("Unable to write version information");
+			}
+			if (data_size > 0) {
 				ostream->write_all(data.get(),
 				                   data_size,
 				                   written);
@@ -797,15 +2139,58 @@ namespace Horizon {
 					g_error("Unable to write complete ImageCache: %" G_GSIZE_FORMAT
 					        " of %" G_GSIZE_FORMAT ".", written, data_size);
 				}
-				ostream->close();
-			} catch (Gio::Error e) {
-				g_error("Failed to write ImageCache file: %s", e.what().c_str());
 			}
+			ostream->close();
+			snapshot_size = CACHE_FILE_HEADER + data_size;
+		} catch (Gio::Error e) {
+			g_error("Failed to write ImageCache file: %s", e.what().c_str());
+		}
+
+		// Everything journaled so far is in the cache file now. If we
+		// die before this, replaying the journal again is harmless.
+		try {
+			auto ostream = journal_file->replace();
+			gsize written = 0;
+			ostream->write_all(&CACHE_JOURNAL_VERSION, sizeof(guint32), written);
+			ostream->close();
+			journal_size = written;
+		} catch (Gio::Error e) {
+			std::cerr << "Error: Unable to truncate image cache journal: "
+			          << e.what() << std::endl;
+		}
+
+		std::shared_ptr<ImageIndex> new_index = std::make_shared<ImageIndex>();
+		if (new_index->open(cache_file->get_path())) {
+			// Readers still holding the old mapping keep it alive
+			std::atomic_store(&index, std::shared_ptr<const ImageIndex>(new_index));
+
+			// Entries only change on this thread, so everything in
+			// the shards is in the new file
+			for (auto &shard : shards) {
+				Glib::Threads::RWLock::WriterLock lock(shard.lock);
+				shard.images.clear();
+				shard.deleted.clear();
+			}
+		} else {
+			std::cerr << "Error: Unable to map the compacted image cache."
+			          << std::endl;
+			std::atomic_store(&index, std::shared_ptr<const ImageIndex>(std::make_shared<ImageIndex>()));
+			for (auto &shard : shards) {
+				Glib::Threads::RWLock::WriterLock lock(shard.lock);
+				shard.images.clear();
+				shard.deleted.clear();
+			}
+			read_from_disk(cache_file, false);
 		}
 
 		std::cout << " done." << std::endl;
 	}
 
+	void ImageCache::compact_if_needed() {
+		if (journal_size > std::max(CACHE_JOURNAL_COMPACT_SIZE, snapshot_size / 2))
+			compact();
+	}
+
 	/*
 	 * Blocking operation
 	 */
@@ -813,15 +2198,14 @@ namespace Horizon {
 		read_from_disk(file, false);
 	}
 
-	void ImageCache::read_from_disk(const Glib::RefPtr<Gio::File>& file,
-	                                const bool make_dirs) {
+	guint32 ImageCache::read_from_disk(const Glib::RefPtr<Gio::File>& file,
+	                                   const bool make_dirs) {
 		if (!file) {
 			std::cerr << "Error: Invalid file pointer passed to read_from_disk"
 			          << std::endl;
-			return;
+			return 0;
 		}
 
-		Glib::Threads::Mutex::Lock lock(map_lock);
 		const bool file_exists = file->query_exists();
 		if (G_UNLIKELY( !file_exists && make_dirs )) {
 			auto parent = file->get_parent();
@@ -851,8 +2235,11 @@ namespace Horizon {
 			goffset fsize = istream->tell();
 			istream->seek(0, Glib::SEEK_TYPE_SET);
 			if (G_UNLIKELY( fsize <= 0 )) {
-				return;
+				return 0;
 			}
+			const bool is_merge = !file->equal(cache_file);
+			if (!is_merge)
+				snapshot_size = fsize;
 			guint32 version = 0;
 			gsize read_bytes = 0;
 			if (G_UNLIKELY( !istream->read_all(&version,
@@ -860,18 +2247,24 @@ namespace Horizon {
 			                                   read_bytes) )) {
 				std::cerr << "Error: Couldn't read image cache versioning."
 				          << std::endl;
-				return;
+				return 0;
 			}
 
 			if (G_UNLIKELY( read_bytes < sizeof(guint32))) {
 				std::cerr << "Error: Couldn't read image cache versioning."
 				          << std::endl;
-				return;
+				return 0;
 			}
 
 			fsize -= read_bytes;
+			if (version == CACHE_FILE_VERSION) {
+				// Padding that aligns the entries for mapping
+				guint32 padding = 0;
+				istream->read_all(&padding, sizeof(guint32), read_bytes);
+				fsize -= read_bytes;
+			}
 			if (G_UNLIKELY( fsize <= 0 )) {
-				return;
+				return version;
 			}
 			std::unique_ptr<gchar> buffer(new gchar[fsize]);
 			if (G_UNLIKELY( !istream->read_all(buffer.get(),
@@ -879,7 +2272,7 @@ namespace Horizon {
 			                                   read_bytes) )) {
 				std::cerr << "Error: Couldn't read image cache"
 				          << std::endl;
-				return;
+				return 0;
 			}
 
 			typedef std::unique_ptr<GVariantType, VariantTypeDeleter> vtype_ptr;
@@ -887,12 +2280,17 @@ namespace Horizon {
 			typedef std::unique_ptr<ImageData> idata_ptr;
 
 			const gchar* vtype = nullptr;
-			if (G_LIKELY( version == 1 )) {
+			guint32 entry_version = 0;
+			if (G_LIKELY( version == CACHE_FILE_VERSION )) {
+				vtype = CACHE_VERSION_2_ARRAYTYPE;
+				entry_version = CACHE_ENTRY_VERSION;
+			} else if (version == 1) {
 				vtype = CACHE_VERSION_1_ARRAYTYPE;
+				entry_version = 1;
 			} else {
 				std::cerr << "Error: Unsupported image cache version "
 				          << version << std::endl;
-				return;
+				return 0;
 			}
 
 			const vtype_ptr gvt(g_variant_type_new(vtype));
@@ -907,7 +2305,7 @@ namespace Horizon {
 			if (G_UNLIKELY( ! g_variant_is_normal_form(v.get()) )) {
 				std::cerr << "Error: ImageCache " << file->get_parse_name()
 				          << " may be corrupted." << std::endl;
-				return;
+				return 0;
 			}
 
 			const gsize elements = g_variant_n_children( v.get() );
@@ -918,30 +2316,83 @@ namespace Horizon {
 							
 			for ( gsize i = 0; i < elements; ++i ) {
 				v_ptr child(g_variant_get_child_value(v.get(), i));
-				idata_ptr cp(new ImageData(version, std::move(child)));
-				if (G_LIKELY( cp )) {
-					auto iter = images.find(cp->md5);
-					if (G_LIKELY( iter == images.end() )) {
-						images.insert(std::make_pair(cp->md5,
-						                             std::move(cp)));
-					} else {
-						iter->second->merge(std::move(cp));
-					}
-				}
+				idata_ptr cp(new ImageData(entry_version, std::move(child)));
+				if (G_LIKELY( cp ))
+					add_entry(std::move(cp), is_merge);
 			}
 
 			istream->close();
+			return version;
 		} catch (Gio::Error e) {
 			std::cerr << "Error: While reading image cache " 
 			          << file->get_parse_name() << ": " 
 			          << e.what();
 		}
+
+		return 0;
+	}
+
+	/* Adds an entry read from a cache file, merging it with ours */
+	void ImageCache::add_entry(std::unique_ptr<ImageData> image_data,
+	                           const bool is_merge) {
+		const std::string md5 = image_data->get_md5();
+		const ImageKey key = make_image_key(md5);
+		ImageShard &shard = get_shard(key);
+		{
+			Glib::Threads::RWLock::WriterLock lock(shard.lock);
+			ImageData *existing = find_entry(shard, key, md5);
+			if (G_LIKELY( existing == nullptr )) {
+				shard.deleted.erase(key);
+				shard.images.insert(std::make_pair(key,
+				                                   std::move(image_data)));
+			} else {
+				existing->merge(std::move(image_data));
+			}
+		}
+
+		if (is_merge)
+			mark_dirty(md5);
 	}
 
 	void ImageCache::loop() {
-		timer_w.set(0., 60. * 5.);
+		timer_w.set(0., 60.);
 		timer_w.again();
-		read_from_disk(cache_file, true);
+		packs.open();
+		std::shared_ptr<ImageIndex> mapped_index = std::make_shared<ImageIndex>();
+		if (mapped_index->open(cache_file->get_path())) {
+			std::atomic_store(&index, std::shared_ptr<const ImageIndex>(mapped_index));
+			snapshot_size = mapped_index->get_file_size();
+			std::cout << "Info: " << cache_file->get_parse_name()
+			          << " has information on " << mapped_index->size()
+			          << " images." << std::endl;
+			goffset journal_end = 0;
+			const guint32 journal_version = replay_journal(journal_end);
+			// Records appended after a torn one would never be replayed
+			const bool torn = journal_end < journal_size &&
+			                  !truncate_journal(journal_end);
+			ready.store(true, std::memory_order_release);
+			ready_dispatcher();
+			if (torn ||
+			    (journal_version != 0 && journal_version != CACHE_JOURNAL_VERSION))
+				compact();
+			else
+				compact_if_needed();
+		} else {
+			const guint32 version = read_from_disk(cache_file, true);
+			goffset journal_end = 0;
+			const guint32 journal_version = replay_journal(journal_end);
+			const bool torn = journal_end < journal_size &&
+			                  !truncate_journal(journal_end);
+			ready.store(true, std::memory_order_release);
+			ready_dispatcher();
+			// Older files are rewritten once so they can be mapped
+			if (torn || (version > 0 && version < CACHE_FILE_VERSION) ||
+			    (journal_version != 0 && journal_version != CACHE_JOURNAL_VERSION))
+				compact();
+			else
+				compact_if_needed();
+		}
+		start_eviction();
 
 		ev_loop.run();
 	}
@@ -952,38 +2403,65 @@ namespace Horizon {
 	}
 
 	void ImageCache::on_kill_loop_w(ev::async &, int) {
+		idle_w.stop();
 		timer_w.stop();
 		flush_w.stop();
 		kill_loop_w.stop();
 		read_queue_w.stop();
 		write_queue_w.stop();
+		image_written_w.stop();
 	}
 
 	ImageCache::~ImageCache() {
+		// Images still on the write lane are recorded by the last flush
+		io_pool.stop();
 		kill_loop_w.send();
 		ev_thread->join();
+		finish_image_writes();
 		flush();
 	}
 
 	ImageCache::ImageCache(const Glib::RefPtr<Gio::File>& file) :
 		cache_file(file),
+		journal_file(file->get_parent()->get_child(CACHE_JOURNAL_FILENAME)),
+		ready(false),
+		journal_size(0),
+		snapshot_size(0),
+		index(std::make_shared<ImageIndex>()),
+		packs(file->get_parent()->get_child("thumbs")->get_path()),
+		io_pool("ImageCache", CACHE_IO_READERS, CACHE_IO_WRITERS),
 		ev_thread(nullptr),
 		ev_loop(ev::AUTO | ev::POLL),
 		kill_loop_w(ev_loop),
 		write_queue_w(ev_loop),
 		read_queue_w(ev_loop),
 		flush_w(ev_loop),
-		timer_w(ev_loop)
+		image_written_w(ev_loop),
+		idle_w(ev_loop),
+		timer_w(ev_loop),
+		quotas_changed(false),
+		pins(),
+		eviction_state(EVICTION_IDLE),
+		eviction_position(0),
+		repack_offset(THUMB_PACK_HEADER),
+		bytes_since_eviction(0)
 	{
+		for (auto &quota : quotas)
+			quota.store(0);
+		eviction_usage.fill(0);
+		ready_dispatcher.connect(sigc::mem_fun(*this, &ImageCache::on_ready_dispatched));
 		write_queue_w.set<ImageCache, &ImageCache::on_write_queue_w>(this);
 		read_queue_w. set<ImageCache, &ImageCache::on_read_queue_w> (this);
 		kill_loop_w.  set<ImageCache, &ImageCache::on_kill_loop_w>  (this);
 		flush_w.      set<ImageCache, &ImageCache::on_flush_w>      (this);
+		image_written_w.set<ImageCache, &ImageCache::on_image_written_w>(this);
 		timer_w.      set<ImageCache, &ImageCache::on_timer_w>      (this);
+		idle_w.       set<ImageCache, &ImageCache::on_idle_w>       (this);
 		write_queue_w.start();
 		read_queue_w.start();
 		kill_loop_w.start();
 		flush_w.start();
+		image_written_w.start();
 
 		const sigc::slot<void> slot = sigc::mem_fun(*this, &ImageCache::loop);
 		int trycount = 0;
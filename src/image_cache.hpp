@@ -2,15 +2,23 @@
 #define IMAGE_CACHE_HPP
 #include <vector>
 #include <set>
+#include <map>
+#include <array>
+#include <unordered_map>
+#include <unordered_set>
 #include <deque>
 #include <memory>
+#include <atomic>
 #include <glibmm/variant.h>
 #include <glibmm/threads.h>
+#include <glibmm/dispatcher.h>
 #include <giomm/file.h>
 #include <giomm/memoryinputstream.h>
 #include <gdkmm/pixbufloader.h>
 #include "thread.hpp"
 #include "canceller.hpp"
+#include "small_set.hpp"
+#include "io_pool.hpp"
 
 #ifdef HAVE_EV___H
 #include <ev++.h>
@@ -32,36 +40,212 @@ namespace Horizon {
 		}
 	};
 
+	struct MappedFileUnrefer {
+		void operator()(GMappedFile* f) {
+			g_mapped_file_unref(f);
+		}
+	};
+
+	/*
+	 * The 16 byte md5 behind the base64 hashes 4chan gives us. Hashes
+	 * that don't decode, like the catalog's stand-ins, are keyed by the
+	 * md5 of the whole string, so only ImageData::get_md5 gives them
+	 * back.
+	 */
+	typedef std::array<guint8, 16> ImageKey;
+	ImageKey make_image_key(const std::string &md5);
+	std::string image_key_to_md5(const ImageKey &key);
+
+	struct ImageKeyHash {
+		std::size_t operator()(const ImageKey &key) const;
+	};
+
+	/* Extensions 4chan serves, anything else is kept as a quark */
+	enum ImageExt : guint8 {IMAGE_EXT_JPG, IMAGE_EXT_PNG, IMAGE_EXT_GIF,
+	                        IMAGE_EXT_WEBM, IMAGE_EXT_PDF, IMAGE_EXT_SWF,
+	                        IMAGE_EXT_MP4, IMAGE_EXT_OTHER};
+
+	/* Each tier has its own disk quota */
+	enum CACHE_TIER {CACHE_TIER_THUMBNAILS, CACHE_TIER_IMAGES, CACHE_TIER_CATALOG, CACHE_TIER_COUNT};
+
+	/*
+	 * Where a thumbnail is in the packs: the pack's number and the
+	 * offset of its bytes. Pack 0 means the thumbnail has a file of
+	 * its own, as all of them did before the packs.
+	 */
+	struct PackLocation {
+		guint32 pack;
+		guint32 offset;
+		guint32 size;
+	};
+
+	/* The thumbnail was written for the catalog */
+	constexpr guint8 IMAGE_FLAG_CATALOG = 1 << 0;
+
+	/*
+	 * What we know about one image. Kept small since there is one per
+	 * image we have ever cached: strings shared between entries are
+	 * quarks, and the sets hold their usual one or two values inline.
+	 */
 	class ImageData {
 	public:
 		ImageData() = delete;
 		ImageData(const ImageData&) = delete;
 		ImageData& operator=(const ImageData&) = delete;
 		~ImageData() = default;
-		ImageData(const guint32 version, const Glib::VariantContainerBase &);
 		explicit ImageData(const guint32 version, std::unique_ptr<GVariant, VariantUnrefer> cvariant);
 		ImageData(const Glib::RefPtr<Post> &post);
 
 	public:
-		void update(const Glib::RefPtr<Post> &post);
+		/* Returns whether anything new was learned from the post */
+		bool update(const Glib::RefPtr<Post> &post);
 		void merge(const std::unique_ptr<ImageData>&);
 
-		Glib::VariantContainerBase get_variant() const;
 		GVariant* get_cvariant() const;
 		Glib::ustring get_uri(bool thumb) const;
 
+		const ImageKey& get_key() const { return key; }
+		std::string get_md5() const;
+		std::string get_ext() const;
+
+		/* Lower scores are evicted first */
+		gint64 get_eviction_score() const;
+		bool is_catalog_thumbnail() const { return flags & IMAGE_FLAG_CATALOG; }
+		PackLocation get_thumb_location() const { return {thumb_pack, thumb_offset, thumb_size}; }
+		void set_catalog_thumbnail() { flags |= IMAGE_FLAG_CATALOG; }
+
 		guint64 size;
-		std::string md5;
-		std::string ext;
-		std::set<Glib::ustring> boards;
-		std::set<Glib::ustring> tags;
-		std::set<std::string> original_filenames; // Potentially UNIX + milli
-		std::set<std::string> poster_names;
-		std::set<gint64> posted_unix_dates;
+		gint64  last_access;
+		guint32 thumb_size;
+		guint32 thumb_pack;
+		guint32 thumb_offset;
 		guint16 num_spoiler;
 		guint16 num_deleted;
 		bool have_thumbnail;
 		bool have_image;
+
+	private:
+		guint8   flags;
+		void set_md5(const std::string &md5);
+		void set_ext(const std::string &ext);
+		bool add_filename(const std::string &filename);
+		bool add_date(const gint64 date);
+		bool add_dates_from_filename(const std::string &filename);
+
+		ImageKey key;
+		ImageExt ext;
+		// Only set for hashes and extensions we can't pack
+		GQuark   unusual_md5;
+		GQuark   unusual_ext;
+		SmallSet<GQuark, 2> boards;
+		SmallSet<GQuark, 2> tags;
+		SmallSet<GQuark, 2> poster_names;
+		SmallSet<gint64, 2> posted_unix_dates;
+		// NUL separated. Usually one UNIX + milli name, which fits
+		// in the string without allocating.
+		std::string original_filenames;
+	};
+
+	/*
+	 * The cache file mapped into memory. Entries are stored sorted by
+	 * md5, so lookups binary search the mapping and nothing is parsed
+	 * until it is asked for.
+	 */
+	class ImageIndex {
+	public:
+		ImageIndex();
+		~ImageIndex();
+		ImageIndex(const ImageIndex&) = delete;
+		ImageIndex& operator=(const ImageIndex&) = delete;
+
+		/* False if the file is missing or not in a mappable version */
+		bool open(const std::string &path);
+		void close();
+
+		gsize size() const;
+		goffset get_file_size() const;
+		std::unique_ptr<GVariant, VariantUnrefer> get(const gsize i) const;
+		/* The entry for md5, or null */
+		std::unique_ptr<GVariant, VariantUnrefer> lookup(const std::string &md5) const;
+
+	private:
+		GMappedFile *mapped;
+		GVariant    *index;
+		gsize        n_entries;
+	};
+
+	/*
+	 * Thumbnails appended one after another to large files, so
+	 * reading a thread's worth of them touches a few mappings instead
+	 * of opening hundreds of small files. Each session appends to a
+	 * pack of its own, starting another once it passes
+	 * THUMB_PACK_SIZE. Packs are never rewritten; the cache copies
+	 * what is still used out of mostly dead ones and removes them.
+	 * Only used on the ImageCache thread.
+	 */
+	class ThumbnailPacks {
+	public:
+		ThumbnailPacks(const std::string &directory);
+		~ThumbnailPacks();
+		ThumbnailPacks(const ThumbnailPacks&) = delete;
+		ThumbnailPacks& operator=(const ThumbnailPacks&) = delete;
+
+		/* Finds the packs earlier sessions wrote */
+		void open();
+		void close();
+
+		bool append(const ImageKey &key,
+		            const std::string &md5,
+		            const guint8 *data,
+		            const guint32 size,
+		            PackLocation &location);
+		/*
+		 * The thumbnail's bytes, or nullptr if the pack doesn't
+		 * hold them. Valid until the pack is next appended to or
+		 * removed.
+		 */
+		const guint8* get(const PackLocation &location);
+		/*
+		 * Reads the record at offset, which is either the pack's
+		 * start or where the last record ended. False once no
+		 * whole record is left.
+		 */
+		bool get_record(const guint32 pack,
+		                const guint32 offset,
+		                ImageKey &key,
+		                std::string &md5,
+		                PackLocation &location);
+
+		/* Packs no longer appended to, oldest first */
+		std::vector<guint32> get_sealed() const;
+		goffset get_size(const guint32 pack) const;
+		void remove(const guint32 pack);
+
+	private:
+		struct Pack {
+			std::string  path;
+			goffset      size;
+			GMappedFile *mapped;
+		};
+
+		std::string                          directory;
+		std::map<guint32, Pack>              packs;
+		guint32                              active;
+		Glib::RefPtr<Gio::FileOutputStream>  ostream;
+		bool start_pack();
+		const guint8* map(Pack &pack, const goffset needed);
+	};
+
+	/*
+	 * One slice of the entries changed since the index was written.
+	 * Lookups take the read lock, so they only wait for a writer of
+	 * the same shard, and only for as long as a map insert.
+	 */
+	struct ImageShard {
+		mutable Glib::Threads::RWLock lock;
+		std::unordered_map<ImageKey, std::unique_ptr<ImageData>, ImageKeyHash> images;
+		// Index entries removed since the index was written
+		std::unordered_set<ImageKey, ImageKeyHash> deleted;
 	};
 
 	class ImageCache {
@@ -71,15 +255,30 @@ namespace Horizon {
 
 		void merge_file(const Glib::RefPtr<Gio::File>& merge_file);
 
+		/*
+		 * False until the index has been loaded. Until then
+		 * has_thumb() and has_image() would block on the loading
+		 * thread, so callers on the main thread should wait for
+		 * signal_ready, which is emitted on the main thread.
+		 */
+		bool is_ready() const;
+		sigc::signal<void> signal_ready;
+
 		bool has_thumb(const Glib::RefPtr<Post> &post);
 		bool has_image(const Glib::RefPtr<Post> &post);
 
 		void get_thumb_async(const Glib::RefPtr<Post> &post,
 		                     std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)> callback,
 		                     std::shared_ptr<Canceller> canceller );
+		/*
+		 * Images are read on the cache's read lane. loader_created
+		 * is called there with the loader before the image is fed
+		 * to it, so callers can follow its progress.
+		 */
 		void get_image_async(const Glib::RefPtr<Post> &post,
 		                     std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)> callback,
-		                     std::shared_ptr<Canceller> canceller );
+		                     std::shared_ptr<Canceller> canceller,
+		                     std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)> loader_created = nullptr);
 
 		void write_thumb_async(const Glib::RefPtr<Post> &post,
 		                       Glib::RefPtr<Gio::MemoryInputStream> &istream);
@@ -87,13 +286,73 @@ namespace Horizon {
 		                       Glib::RefPtr<Gio::MemoryInputStream> &istream);
 
 		void clean_invalid();
+		/* Appends what changed since the last flush to the journal */
 		void flush();
 
+		/*
+		 * Disk budgets in bytes, 0 for no limit. The cache thread
+		 * evicts down to them soon after.
+		 */
+		void set_quotas(const guint64 thumbnails,
+		                const guint64 images,
+		                const guint64 catalog);
+		/* Pinned images are never evicted. Pins nest. */
+		void pin(const std::string &md5);
+		void unpin(const std::string &md5);
+
 	private:
 		Glib::RefPtr<Gio::File> cache_file;
-
-		mutable Glib::Threads::Mutex map_lock;
-		std::map<std::string, std::unique_ptr<ImageData> > images;
+		Glib::RefPtr<Gio::File> journal_file;
+		std::atomic<bool>       ready;
+		Glib::Dispatcher        ready_dispatcher;
+		void                    on_ready_dispatched();
+		goffset                 journal_size;
+		goffset                 snapshot_size;
+
+		/*
+		 * Entries are looked up in their shard first, then in the
+		 * mapped index. Compaction swaps in a new index before it
+		 * empties the shards, so a lookup that misses its shard
+		 * always finds an index at least as new.
+		 */
+		std::shared_ptr<const ImageIndex> index;
+		std::array<ImageShard, 16> shards;
+		ThumbnailPacks packs;
+		ImageShard& get_shard(const ImageKey &key);
+		const ImageShard& get_shard(const ImageKey &key) const;
+		std::unique_ptr<ImageData> load_entry(const ImageShard &shard,
+		                                      const ImageKey &key,
+		                                      const std::string &md5) const;
+		ImageData* find_entry(ImageShard &shard,
+		                      const ImageKey &key,
+		                      const std::string &md5);
+		bool has_file(const std::string &md5, const bool thumb) const;
+
+		/* md5s changed or removed since the last flush */
+		mutable Glib::Threads::Mutex dirty_lock;
+		std::set<std::string> dirty;
+		std::set<std::string> removed;
+		void mark_dirty(const std::string &md5);
+
+		/*
+		 * Returns the version of the journal replayed, 0 if none
+		 * was, and sets valid_end to where its last whole record
+		 * ends.
+		 */
+		guint32 replay_journal(goffset &valid_end);
+		/* Cuts off a torn record so later appends can be replayed */
+		bool truncate_journal(const goffset size);
+		/* Returns whether all of the records were written */
+		bool append_to_journal(const std::vector<GVariant*> &records);
+		void compact();
+		void compact_if_needed();
+
+		/*
+		 * Full images are read and written on the pool, so the
+		 * thumbnails, which stay on the cache thread with the packs,
+		 * never wait behind them.
+		 */
+		IOPool io_pool;
 
 		mutable Glib::Threads::Mutex thumb_write_queue_lock;
 		std::deque< std::pair< Glib::RefPtr<Post>,
@@ -101,32 +360,70 @@ namespace Horizon {
 		void write(const Glib::RefPtr<Post> &,
 		           Glib::RefPtr<Gio::MemoryInputStream>,
 		           const bool write_thumb);
+		/* Called with the shard's writer lock held */
+		ImageData* find_or_add_entry(ImageShard &shard,
+		                             const ImageKey &key,
+		                             const Glib::RefPtr<Post> &post);
+		void record_write(const Glib::RefPtr<Post> &post,
+		                  const bool write_thumb,
+		                  const PackLocation &location,
+		                  const gssize written);
 		                 
 		mutable Glib::Threads::Mutex image_write_queue_lock;
 		std::deque< std::pair< Glib::RefPtr<Post>,
 		                       Glib::RefPtr<Gio::MemoryInputStream> > > image_write_queue;
+		void write_image_file(const Glib::RefPtr<Post> &post,
+		                      Glib::RefPtr<Gio::MemoryInputStream> istream,
+		                      const Glib::RefPtr<Gio::File> &file);
+		/* Only used on the cache thread */
+		std::unordered_set<ImageKey, ImageKeyHash> images_being_written;
+		/* Images the write lane is done with, and bytes written or -1 */
+		mutable Glib::Threads::Mutex image_written_queue_lock;
+		std::deque< std::pair< Glib::RefPtr<Post>, gssize> > image_written_queue;
+		void finish_image_writes();
 
 		mutable Glib::Threads::Mutex thumb_read_queue_lock;
 		std::deque< std::tuple< Glib::RefPtr<Post>,
 		                        std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)>,
 		                        std::shared_ptr<Canceller> > > thumb_read_queue;
 		void read_thumb(const Glib::RefPtr<Post>&,
+		                const Glib::RefPtr<Gio::File>&,
+		                const PackLocation &location,
 		                std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)>,
 		                std::shared_ptr<Canceller> canceller);
+		void move_to_pack(const std::string &md5,
+		                  const guint8 *data,
+		                  const gsize size,
+		                  const Glib::RefPtr<Gio::File> &file);
+		void forget_thumb(const std::string &md5);
 
 		mutable Glib::Threads::Mutex image_read_queue_lock;
 		std::deque< std::tuple< Glib::RefPtr<Post>,
 		                        std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)>,
-		                        std::shared_ptr<Canceller> > > image_read_queue;
+		                        std::shared_ptr<Canceller>,
+		                        std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)> > > image_read_queue;
 		void read_image(const Glib::RefPtr<Post> &,
 		                std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)>,
-		                std::shared_ptr<Canceller> canceller);
+		                std::shared_ptr<Canceller> canceller,
+		                std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)> loader_created);
+		Glib::RefPtr<Gio::File> update_for_read(const Glib::RefPtr<Post> &post,
+		                                        const bool is_thumb,
+		                                        PackLocation &location);
+		void                    add_entry(std::unique_ptr<ImageData> image_data,
+		                                  const bool is_merge);
 
 		void read(const Glib::RefPtr<Gio::File>&,
 		          std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)>,
-		          std::shared_ptr<Canceller> canceller);
+		          std::shared_ptr<Canceller> canceller,
+		          std::function<void (const Glib::RefPtr<Gdk::PixbufLoader>&)> loader_created = nullptr);
+		std::unique_ptr<GMappedFile, MappedFileUnrefer> map_file(const Glib::RefPtr<Gio::File>&);
+
+		/* Files to remove once the journal no longer points at them */
+		std::vector<Glib::RefPtr<Gio::File> > remove_after_flush;
+		std::vector<guint32>                  packs_after_flush;
 
-		void             read_from_disk(const Glib::RefPtr<Gio::File>& cache_file,
+		/* Returns the version of the file read, 0 if none was */
+		guint32          read_from_disk(const Glib::RefPtr<Gio::File>& cache_file,
 		                                const bool make_dirs);
 
 		Glib::Threads::Thread *ev_thread;
@@ -145,19 +442,141 @@ namespace Horizon {
 		ev::async        flush_w;
 		void             on_flush_w(ev::async &, int);
 
+		ev::async        image_written_w;
+		void             on_image_written_w(ev::async &, int);
+
 		ev::idle         idle_w;
 		void             on_idle_w(ev::idle &, int);
 
 		ev::timer        timer_w;
 		void             on_timer_w(ev::timer &, int);
 
+		/*
+		 * Eviction runs from idle_w a chunk at a time: it scans the
+		 * index and then the shards for what each tier uses, and if
+		 * any tier is over quota deletes the lowest scoring files of
+		 * that tier. It then copies the live thumbnails out of packs
+		 * that are mostly dead, or small, and removes those packs.
+		 * Everything here but the quotas and pins belongs to the
+		 * cache thread.
+		 */
+		std::array<std::atomic<guint64>, CACHE_TIER_COUNT> quotas;
+		std::atomic<bool>                                  quotas_changed;
+		mutable Glib::Threads::Mutex                       pin_lock;
+		std::unordered_map<ImageKey, guint, ImageKeyHash>  pins;
+		bool is_pinned(const ImageKey &key) const;
+
+		struct EvictionCandidate {
+			gint64      score;
+			ImageKey    key;
+			// The key can't give back hashes that aren't md5s
+			std::string md5;
+			guint32     bytes;
+			CACHE_TIER tier;
+		};
+		enum EVICTION_STATE {EVICTION_IDLE, EVICTION_SCAN_INDEX,
+		                     EVICTION_SCAN_SHARDS, EVICTION_DELETE,
+		                     EVICTION_REPACK};
+		EVICTION_STATE                         eviction_state;
+		std::shared_ptr<const ImageIndex>      eviction_index;
+		gsize                                  eviction_position;
+		std::vector<ImageKey>                  eviction_shard_keys;
+		std::vector<EvictionCandidate>         eviction_candidates;
+		std::array<guint64, CACHE_TIER_COUNT>  eviction_usage;
+		std::map<guint32, guint64>             eviction_pack_live;
+		std::vector<guint32>                   repack_queue;
+		guint32                                repack_offset;
+		guint64                                bytes_since_eviction;
+		void start_eviction();
+		/* Returns whether there are packs to repack */
+		bool start_repack();
+		enum REPACK_RESULT {REPACK_NEXT, REPACK_PACK_DONE, REPACK_FAILED};
+		REPACK_RESULT repack_record();
+		void start_eviction_if_needed();
+		void consider_for_eviction(const ImageKey &key,
+		                           const std::string &md5,
+		                           const gint64 score,
+		                           const guint64 image_size,
+		                           const guint32 thumb_size,
+		                           const guint32 thumb_pack,
+		                           const bool have_thumbnail,
+		                           const bool have_image,
+		                           const bool is_catalog);
+		/* Returns false once the pass is over */
+		bool step_eviction();
+		bool evict(const EvictionCandidate &candidate);
+
 	};
 
 	constexpr char CACHE_FILENAME[] = "horizon-cache.dat";
 	constexpr char CACHE_MERGE_FILENAME[] = "horizon-cache.merge";
-	constexpr guint32 CACHE_FILE_VERSION = 1;
+	/*
+	 * Version 2 pads the version out to 8 bytes so the entries can be
+	 * mapped in place, keeps them sorted by md5 and adds to each entry
+	 * its last access time, the thumbnail's size, flags, pack and
+	 * offset.
+	 */
+	constexpr guint32 CACHE_FILE_VERSION = 2;
+	constexpr gsize CACHE_FILE_HEADER = 8;
+	constexpr guint32 CACHE_ENTRY_VERSION = 2;
 	constexpr char CACHE_VERSION_1_TYPE[] = "(tayayasasaayaayaxqqbb)";
 	constexpr char CACHE_VERSION_1_ARRAYTYPE[] = "a(tayayasasaayaayaxqqbb)";
+	constexpr char CACHE_VERSION_2_TYPE[] = "(tayayasasaayaayaxqqbbxuyuu)";
+	constexpr char CACHE_VERSION_2_ARRAYTYPE[] = "a(tayayasasaayaayaxqqbbxuyuu)";
+
+	/*
+	 * The journal is the version, then records of a guint32 payload
+	 * size, a guint32 FNV-1a checksum of the payload, and the payload:
+	 * an md5 with either the entry's new state or nothing if it was
+	 * removed.
+	 */
+	constexpr char CACHE_JOURNAL_FILENAME[] = "horizon-cache.journal";
+	constexpr guint32 CACHE_JOURNAL_VERSION = 1;
+	constexpr char CACHE_JOURNAL_RECORD_TYPE[] = "(aym(tayayasasaayaayaxqqbbxuyuu))";
+	// The journal is folded into the cache file once it passes this
+	// size and half the size of the cache file
+	constexpr goffset CACHE_JOURNAL_COMPACT_SIZE = 4 * 1024 * 1024;
+
+	// Each repost of an image counts as this many seconds of recency,
+	// up to CACHE_EVICTION_MAX_REPOSTS of them
+	constexpr gint64 CACHE_EVICTION_REPOST_BONUS = 24 * 60 * 60;
+	constexpr gsize CACHE_EVICTION_MAX_REPOSTS = 30;
+	// Reads only bump the last access time once per this many seconds
+	constexpr gint64 CACHE_ACCESS_GRANULARITY = 60 * 60;
+	// Entries scanned, and files deleted, per idle callback
+	constexpr gsize CACHE_EVICTION_SCAN_CHUNK = 512;
+	constexpr gsize CACHE_EVICTION_DELETE_CHUNK = 32;
+	// Bytes written before the next eviction pass
+	constexpr guint64 CACHE_EVICTION_INTERVAL_BYTES = 32 * 1024 * 1024;
+	// A pass evicts down to this share of the quota
+	constexpr double CACHE_EVICTION_LOW_WATER = 0.9;
+	// Workers in each of the cache's I/O lanes. Reads also decode.
+	constexpr unsigned int CACHE_IO_READERS = 2;
+	constexpr unsigned int CACHE_IO_WRITERS = 1;
+	// Bytes handed to a PixbufLoader at a time, so large images can
+	// be drawn as they decode
+	constexpr gsize CACHE_READ_CHUNK = 64 * 1024;
+	// Thumbnails cached before their size was recorded
+	constexpr guint32 CACHE_THUMB_SIZE_ESTIMATE = 6 * 1024;
+
+	/*
+	 * A pack is a guint32 magic and version, then records of a
+	 * guint32 magic, the guint32 size of the thumbnail, its 16 byte
+	 * key, the guint32 length of its hash, the hash and the
+	 * thumbnail. The hash is kept whole since keys of hashes that
+	 * aren't md5s can't be turned back into them.
+	 */
+	constexpr guint32 THUMB_PACK_MAGIC = 0x4b505448; // "HTPK"
+	constexpr guint32 THUMB_PACK_VERSION = 1;
+	constexpr gsize THUMB_PACK_HEADER = 8;
+	constexpr guint32 THUMB_PACK_RECORD_MAGIC = 0x44525448; // "HTRD"
+	// Not counting the hash
+	constexpr gsize THUMB_PACK_RECORD_HEADER = 28;
+	constexpr goffset THUMB_PACK_SIZE = 64 * 1024 * 1024;
+	// Packs smaller than this are merged into the session's pack
+	constexpr goffset THUMB_PACK_MERGE_SIZE = 4 * 1024 * 1024;
+	// Records copied out of old packs per idle callback
+	constexpr gsize THUMB_PACK_REPACK_CHUNK = 64;
 }
 
 
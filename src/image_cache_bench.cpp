@@ -0,0 +1,196 @@
+/*
+ * Measures what ImageData costs per image. Builds the entries of a
+ * cache the size of a heavy user's, 200k images by default, from the
+ * same variants the cache file holds and reports the heap they use,
+ * both as ImageCache keeps them and in the std::map of std::set
+ * layout it replaced, so the two can be compared on one machine.
+ * Not run by make check; use make bench.
+ */
+#include "image_cache.hpp"
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+using namespace Horizon;
+
+namespace {
+	const gsize DEFAULT_ENTRIES = 200000;
+	const std::array<const gchar*, 8> BOARDS{ {"g", "a", "v", "wg", "w", "b", "fit", "diy"} };
+	const std::array<const gchar*, 4> EXTS{ {".jpg", ".png", ".gif", ".webm"} };
+
+	/*
+	 * ImageData before it was packed: every field in its own
+	 * container, keyed by md5 in one std::map.
+	 */
+	struct BaselineImageData {
+		guint64 size;
+		std::string md5;
+		std::string ext;
+		std::set<Glib::ustring> boards, tags;
+		std::set<std::string> original_filenames, poster_names;
+		std::set<gint64> posted_unix_dates;
+		guint16 num_spoiler, num_deleted;
+		gboolean have_thumbnail, have_image;
+
+		explicit BaselineImageData(GVariant *variant);
+	};
+
+	template <typename Set>
+	void insert_strv(Set &set, GVariant *array, const gboolean bytestrings) {
+		const gchar **strv = bytestrings ? g_variant_get_bytestring_array(array, nullptr)
+		                                 : g_variant_get_strv(array, nullptr);
+		for (gsize i = 0; strv[i]; i++)
+			set.insert(strv[i]);
+		g_free(strv);
+		g_variant_unref(array);
+	}
+
+	// The version 1 fields lead every entry, so this reads any of them
+	BaselineImageData::BaselineImageData(GVariant *variant) {
+		const gchar *string;
+		g_variant_get_child(variant, 0, "t", &size);
+		g_variant_get_child(variant, 1, "^&ay", &string);
+		md5 = string;
+		g_variant_get_child(variant, 2, "^&ay", &string);
+		ext = string;
+		insert_strv(boards, g_variant_get_child_value(variant, 3), FALSE);
+		insert_strv(tags, g_variant_get_child_value(variant, 4), FALSE);
+		insert_strv(original_filenames, g_variant_get_child_value(variant, 5), TRUE);
+		insert_strv(poster_names, g_variant_get_child_value(variant, 6), TRUE);
+		GVariant *vdates = g_variant_get_child_value(variant, 7);
+		gsize n_dates = 0;
+		const gint64 *dates = static_cast<const gint64*>(g_variant_get_fixed_array(vdates, &n_dates, sizeof(gint64)));
+		posted_unix_dates.insert(dates, dates + n_dates);
+		g_variant_unref(vdates);
+		g_variant_get_child(variant, 8, "q", &num_spoiler);
+		g_variant_get_child(variant, 9, "q", &num_deleted);
+		g_variant_get_child(variant, 10, "b", &have_thumbnail);
+		g_variant_get_child(variant, 11, "b", &have_image);
+	}
+
+	void report(const gchar *layout, const gsize stored, const gsize before, const gsize after) {
+#ifdef __GLIBC__
+		const double per_entry = static_cast<double>(after - before) / stored;
+		std::cout << std::fixed << std::setprecision(1) << layout << ": "
+		          << per_entry << " bytes per entry, including its map node, "
+		          << (after - before) / (1024.0 * 1024.0) << " MB in all" << std::endl;
+#else
+		(void)layout;
+		(void)stored;
+		(void)before;
+		(void)after;
+#endif
+	}
+
+	gsize heap_in_use() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+		return mallinfo2().uordblks;
+#elif defined(__GLIBC__)
+		return static_cast<guint>(mallinfo().uordblks);
+#else
+		return 0;
+#endif
+	}
+
+	/*
+	 * One image as 4chan would describe it: a real md5, one board, a
+	 * UNIX-millisecond filename, one poster and two dates. Every 20th
+	 * is a catalog thumbnail with a stand-in hash.
+	 */
+	GVariant* make_entry(const gsize i) {
+		const gchar *board = BOARDS[i % BOARDS.size()];
+		const gint64 date = 1380000000 + static_cast<gint64>(i) * 17;
+		gchar *md5;
+		if (i % 20 == 0) {
+			md5 = g_strdup_printf("{FAKEHASH}%s-%" G_GSIZE_FORMAT "-%" G_GINT64_FORMAT,
+			                      board, 40000000 + i, date);
+		} else {
+			std::array<guint8, 16> digest;
+			for (gsize j = 0; j < digest.size(); j++)
+				digest[j] = static_cast<guint8>((i * 2654435761u) >> (j % 4 * 8)) ^ static_cast<guint8>(j * 31);
+			md5 = g_base64_encode(digest.data(), digest.size());
+		}
+		gchar *filename = g_strdup_printf("%" G_GINT64_FORMAT, date * 1000 + static_cast<gint64>(i % 1000));
+		const gchar *boards[] = {board, nullptr};
+		const gchar *tags[] = {nullptr};
+		const gchar *filenames[] = {filename, nullptr};
+		const gchar *posters[] = {"Anonymous", nullptr};
+		const std::array<gint64, 2> dates{ {date, date + 3600} };
+
+		GVariant *vdates = g_variant_new_fixed_array(G_VARIANT_TYPE_INT64, dates.data(),
+		                                             dates.size(), sizeof(gint64));
+
+		// CACHE_VERSION_2_TYPE, spelled out for g_variant_new
+		GVariant *entry = g_variant_new("(t^ay^ay^as^as^aay^aay@axqqbbxuyuu)",
+		                                static_cast<guint64>(150000 + i % 1000000),
+		                                md5,
+		                                EXTS[i % EXTS.size()],
+		                                boards, tags, filenames, posters,
+		                                vdates,
+		                                0, 0,
+		                                TRUE, static_cast<gboolean>(i % 3 == 0),
+		                                date,
+		                                static_cast<guint32>(6000 + i % 4000),
+		                                static_cast<guint>(i % 20 == 0 ? IMAGE_FLAG_CATALOG : 0),
+		                                static_cast<guint32>(1 + i / 10000),
+		                                static_cast<guint32>(8 + (i % 10000) * 6000));
+		g_free(filename);
+		g_free(md5);
+		return g_variant_ref_sink(entry);
+	}
+}
+
+int main(int argc, char **argv) {
+	const gsize entries = argc > 1 ? g_ascii_strtoull(argv[1], nullptr, 10) : DEFAULT_ENTRIES;
+	if (entries == 0) {
+		std::cerr << "Usage: image_cache_bench [entries]" << std::endl;
+		return 1;
+	}
+
+	std::vector<GVariant*> variants;
+	variants.reserve(entries);
+	for (gsize i = 0; i < entries; i++)
+		variants.push_back(make_entry(i));
+
+	gsize before = heap_in_use();
+	std::map<std::string, std::unique_ptr<BaselineImageData>> baseline;
+	for (GVariant *variant : variants) {
+		std::unique_ptr<BaselineImageData> image_data(new BaselineImageData(variant));
+		const std::string md5 = image_data->md5;
+		baseline.insert(std::make_pair(md5, std::move(image_data)));
+	}
+	gsize after = heap_in_use();
+	const gsize baseline_stored = baseline.size();
+	std::cout << baseline_stored << " of " << entries << " entries, sizeof(baseline ImageData) "
+	          << sizeof(BaselineImageData) << ", sizeof(ImageData) "
+	          << sizeof(ImageData) << std::endl;
+	report("baseline", baseline_stored, before, after);
+	baseline.clear();
+
+	// Laid out as ImageCache keeps them
+	std::array<ImageShard, 16> shards;
+	for (auto &shard : shards)
+		shard.images.reserve(entries / shards.size() + 1);
+
+	before = heap_in_use();
+	for (GVariant *variant : variants) {
+		std::unique_ptr<ImageData> image_data(new ImageData(CACHE_ENTRY_VERSION,
+		                                      std::unique_ptr<GVariant, VariantUnrefer>(g_variant_ref(variant))));
+		const ImageKey key = image_data->get_key();
+		shards[key[0] % shards.size()].images.insert(std::make_pair(key, std::move(image_data)));
+	}
+	after = heap_in_use();
+
+	gsize stored = 0;
+	for (const auto &shard : shards)
+		stored += shard.images.size();
+	report("packed", stored, before, after);
+
+	for (GVariant *variant : variants)
+		g_variant_unref(variant);
+
+	return stored == entries && baseline_stored == entries ? 0 : 1;
+}
@@ -78,14 +78,7 @@ namespace Horizon {
 				try {
 					// Supports "jpeg" "gif" "png"
 					request->loader = Gdk::PixbufLoader::create();
-					if (request->area_prepared_functor) {
-						auto area_prepared_slot = sigc::bind(sigc::mem_fun(*this, &ImageFetcher::on_area_prepared),
-						                                     request);
-						request->area_prepared_connection = request->loader->signal_area_prepared().connect(area_prepared_slot);
-					}
-					auto area_updated_slot = sigc::bind(sigc::mem_fun(*this, &ImageFetcher::on_area_updated),
-					                                    request);
-					request->area_updated_connection = request->loader->signal_area_updated().connect(area_updated_slot);
+					connect_loader(request);
 
 					curl_multi->add_handle(easy);
 				} catch ( Gdk::PixbufError e ) {
@@ -104,7 +97,21 @@ namespace Horizon {
 	}
 	
 	/*
-	 * Called on ev_thread
+	 * Called on ev_thread or an ImageCache read lane
+	 */
+	void ImageFetcher::connect_loader(std::shared_ptr<Request> request) {
+		if (request->area_prepared_functor) {
+			auto area_prepared_slot = sigc::bind(sigc::mem_fun(*this, &ImageFetcher::on_area_prepared),
+			                                     request);
+			request->area_prepared_connection = request->loader->signal_area_prepared().connect(area_prepared_slot);
+		}
+		auto area_updated_slot = sigc::bind(sigc::mem_fun(*this, &ImageFetcher::on_area_updated),
+		                                    request);
+		request->area_updated_connection = request->loader->signal_area_updated().connect(area_updated_slot);
+	}
+
+	/*
+	 * Called on ev_thread or an ImageCache read lane
 	 */
 	void ImageFetcher::on_area_prepared(std::shared_ptr<Request> request) {
 		if (request->area_prepared_functor) {
@@ -123,13 +130,14 @@ namespace Horizon {
 	}
 
 	/*
-	 * Called on ev_thread
+	 * Called on ev_thread or an ImageCache read lane
 	 */
 	void ImageFetcher::on_area_updated(int x, int y, int width, int height,
 	                                   std::shared_ptr<Request> request) {
 		if (request->area_updated_functor) {
 			auto f = std::bind(request->area_updated_functor, x, y, width, height);
 			{
+				Glib::Threads::Mutex::Lock lock(pixbuf_update_queue_mutex);
 				auto pair = std::make_pair(request->canceller, std::move(f));
 				pixbuf_update_queue.push_back(pair);
 			}
@@ -211,6 +219,7 @@ namespace Horizon {
 		req->area_prepared_functor = area_prepared_cb;
 		req->area_updated_functor = area_updated_cb;
 		req->canceller = canceller;
+		req->priority = PRIORITY_NORMAL;
 		req->serial = serial++;
 		return req;
 	}
@@ -228,35 +237,71 @@ namespace Horizon {
 			g_warning("ImageFetcher::download() called with invalid post");
 			return;
 		}
+		auto loader = pixbuf_cache->get(post->get_hash(), get_thumb);
+		if (loader) {
+			queue_cb(canceller, std::bind(callback, loader));
+			return;
+		}
+
 		std::string request_key = get_request_key(post, get_thumb);
 
 		bool is_pending = add_request_cb(request_key, callback);
 		if ( !is_pending ) {
-			bool in_cache = false;
 			std::shared_ptr<Request> request = create_request(post, get_thumb,
 			                                                  area_prepared_cb,
 			                                                  area_updated_cb,
 			                                                  canceller);
-			auto cache_cb = std::bind(&ImageFetcher::on_cache_result,
-			                          this,
-			                          std::placeholders::_1,
-			                          request);
-			if (get_thumb) {
-				if (image_cache->has_thumb(post)) {
-					image_cache->get_thumb_async(post, cache_cb, this->canceller);
-					in_cache = true;
-				}
+			if (image_cache->is_ready()) {
+				lookup(request);
 			} else {
-				if (image_cache->has_image(post)) {
-					image_cache->get_image_async(post, cache_cb, this->canceller);
-					in_cache = true;
-				}
+				deferred_lookups.push_back(request);
 			}
+		}
+	}
 
-			if (!in_cache) {
-				add_request(request);
+	/*
+	 * Called from Glib main thread. Reads the image from the cache or
+	 * queues its download.
+	 */
+	void ImageFetcher::lookup(std::shared_ptr<Request> request) {
+		bool in_cache = false;
+		auto cache_cb = std::bind(&ImageFetcher::on_cache_result,
+		                          this,
+		                          std::placeholders::_1,
+		                          request);
+		if (request->is_thumb) {
+			if (image_cache->has_thumb(request->post)) {
+				image_cache->get_thumb_async(request->post, cache_cb, this->canceller);
+				in_cache = true;
+			}
+		} else {
+			if (image_cache->has_image(request->post)) {
+				// Full images are drawn as they decode from disk,
+				// just like downloads
+				auto loader_created = [this, request](const Glib::RefPtr<Gdk::PixbufLoader> &loader) {
+					request->loader = loader;
+					connect_loader(request);
+				};
+				image_cache->get_image_async(request->post, cache_cb, this->canceller,
+				                             loader_created);
+				in_cache = true;
 			}
 		}
+
+		if (!in_cache) {
+			add_request(request);
+		}
+	}
+
+	/*
+	 * Called from Glib main thread
+	 */
+	void ImageFetcher::on_cache_ready() {
+		std::vector<std::shared_ptr<Request> > requests;
+		requests.swap(deferred_lookups);
+
+		for (auto request : requests)
+			lookup(request);
 	}
 
 	/*
@@ -282,6 +327,7 @@ namespace Horizon {
 	void ImageFetcher::add_request(const std::shared_ptr<Request> &request) {
 		Glib::Threads::RWLock::WriterLock lock(request_queue_rwlock);
 		
+		request->priority = get_priority(request->hash);
 		new_request_queue.push_back(request);
 		std::push_heap(new_request_queue.begin(),
 		               new_request_queue.end(),
@@ -289,6 +335,34 @@ namespace Horizon {
 		queue_w.send();
 	}
 
+	/*
+	 * Called from Glib main thread
+	 */
+	void ImageFetcher::prioritize(const std::map<std::string, REQUEST_PRIORITY> &priorities,
+	                              const REQUEST_PRIORITY fallback) {
+		Glib::Threads::RWLock::WriterLock lock(request_queue_rwlock);
+
+		request_priorities = priorities;
+		request_priority_fallback = fallback;
+		for ( auto request : new_request_queue ) {
+			request->priority = get_priority(request->hash);
+		}
+		std::make_heap(new_request_queue.begin(),
+		               new_request_queue.end(),
+		               request_comparitor);
+	}
+
+	/*
+	 * request_queue_rwlock must be held
+	 */
+	REQUEST_PRIORITY ImageFetcher::get_priority(const std::string &hash) const {
+		auto iter = request_priorities.find(hash);
+		if ( iter != request_priorities.end() )
+			return iter->second;
+
+		return request_priority_fallback;
+	}
+
 	/*
 	 * Called on ev_thread
 	 */
@@ -516,13 +590,16 @@ namespace Horizon {
 	}
 
 	/*
-	 * Called on ImageCache thread or ev_thread
+	 * Called on ImageCache thread, its read lanes or ev_thread
 	 */
 	bool ImageFetcher::bind_loader_to_callbacks(std::shared_ptr<Request> request,
 	                                            const Glib::RefPtr<Gdk::PixbufLoader> &loader) {
 		std::string request_key = get_request_key(request->post,
 		                                          request->is_thumb);
 		bool found_cb = false;
+		if (loader)
+			pixbuf_cache->insert(request->hash, request->is_thumb, loader);
+
 		Glib::Threads::RWLock::WriterLock lock(request_cb_rwlock);
 		auto iter_pair = request_cb_map.equal_range(request_key);
 		auto lower_bound = iter_pair.first;
@@ -559,6 +636,19 @@ namespace Horizon {
 		}
 	}
 
+	/*
+	 * Called from Glib main thread
+	 */
+	void ImageFetcher::queue_cb(std::shared_ptr<Canceller> canceller,
+	                            std::function<void ()> cb) {
+		Glib::Threads::RWLock::WriterLock cb_queue_lock(cb_queue_rwlock);
+		cb_queue.push_back(std::make_pair(canceller, std::move(cb)));
+		auto is_connected = cb_queue_is_connected.exchange(true);
+		if (!is_connected) {
+			signal_process_cb_queue();
+		}
+	}
+
 	/*
 	 * Called on Glib MainLoop idle
 	 */
@@ -583,10 +673,13 @@ namespace Horizon {
 	}
 
 	/* 
-	 * Called from ImageCache thread
+	 * Called from ImageCache thread or its read lanes
 	 */
 	void ImageFetcher::on_cache_result(const Glib::RefPtr<Gdk::PixbufLoader>& loader,
 	                                   std::shared_ptr<Request> request) {
+		request->area_prepared_connection.disconnect();
+		request->area_updated_connection.disconnect();
+
 		if (loader) {
 			bind_loader_to_callbacks(request, loader);
 		} else {
@@ -659,9 +752,12 @@ namespace Horizon {
 		start_new_download();
 	}
 
-	ImageFetcher::ImageFetcher(const std::shared_ptr<ImageCache>& cache) :
+	ImageFetcher::ImageFetcher(const std::shared_ptr<ImageCache>& cache,
+	                           const std::shared_ptr<PixbufCache>& pixbufs) :
 		canceller(std::make_shared<Canceller>()),
 		image_cache(cache),
+		pixbuf_cache(pixbufs),
+		request_priority_fallback(PRIORITY_NORMAL),
 		cb_queue_is_connected(false),
 		pixbuf_updated_idle_is_connected(false),
 		curl_error_buffer(g_new0(char, CURL_ERROR_SIZE)),
@@ -675,6 +771,7 @@ namespace Horizon {
 	{
 		signal_pixbuf_updated.connect(sigc::mem_fun(*this, &ImageFetcher::signal_pixbuf_updated_dispatched));
 		signal_process_cb_queue.connect(sigc::mem_fun(*this, &ImageFetcher::signal_process_cb_queue_dispatched));
+		cache_ready_connection = image_cache->signal_ready.connect(sigc::mem_fun(*this, &ImageFetcher::on_cache_ready));
 		Glib::Threads::Mutex::Lock lock(curl_data_mutex);
 
 		curl_multi->set_socket_function(&curl_socket_cb, this);
@@ -716,6 +813,7 @@ namespace Horizon {
 
 	ImageFetcher::~ImageFetcher() {
 		canceller->cancel();
+		cache_ready_connection.disconnect();
 		if (cb_queue_idle)
 			cb_queue_idle.disconnect();
 		if (pixbuf_updated_idle)
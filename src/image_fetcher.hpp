@@ -20,6 +20,7 @@
 #include <glibmm/dispatcher.h>
 #include <glibmm/threads.h>
 #include "image_cache.hpp"
+#include "pixbuf_cache.hpp"
 #include "horizon_curl.hpp"
 #include "canceller.hpp"
 
@@ -36,6 +37,12 @@ namespace Horizon {
 
 	enum FETCH_TYPE {FOURCHAN, CATALOG};
 
+	/*
+	 * Lower values are downloaded first. The catalog uses these to
+	 * pull the thumbnails of rows on screen ahead of the rest.
+	 */
+	enum REQUEST_PRIORITY {PRIORITY_VISIBLE, PRIORITY_NEAR, PRIORITY_NORMAL, PRIORITY_FAR};
+
 	struct Request {
 		guint64 serial;
 		Glib::RefPtr< Gdk::PixbufLoader > loader;
@@ -45,6 +52,7 @@ namespace Horizon {
 		std::string url;
 		std::string ext;
 		bool is_thumb;
+		REQUEST_PRIORITY priority;
 
 		std::function<void (Glib::RefPtr<Gdk::Pixbuf>)> area_prepared_functor;
 		std::function<void (int, int, int, int)> area_updated_functor;
@@ -55,7 +63,8 @@ namespace Horizon {
 
 	class ImageFetcher {
 	public:
-		ImageFetcher(const std::shared_ptr<ImageCache>& cache);
+		ImageFetcher(const std::shared_ptr<ImageCache>& cache,
+		             const std::shared_ptr<PixbufCache>& pixbufs);
 		~ImageFetcher();
 
 		/* Old interface */
@@ -71,20 +80,39 @@ namespace Horizon {
 		              std::function<void (int, int, int, int)> area_updated_cb = nullptr
  		              );
 
+		/*
+		 * Reorders the queued requests. Requests whose hash is
+		 * not in priorities get fallback, as do requests made
+		 * before the next call.
+		 */
+		void prioritize(const std::map<std::string, REQUEST_PRIORITY> &priorities,
+		                const REQUEST_PRIORITY fallback);
+
 	private:
 		struct RequestComparitor {
 			typedef std::shared_ptr<Request> value_type;
 			bool operator() (const std::shared_ptr<Request> &lhs,
 			                 const std::shared_ptr<Request> &rhs) {
-				return (rhs->is_thumb && !lhs->is_thumb) || (rhs->serial < lhs->serial);
+				if (lhs->is_thumb != rhs->is_thumb)
+					return rhs->is_thumb;
+				if (lhs->priority != rhs->priority)
+					return rhs->priority < lhs->priority;
+				return rhs->serial < lhs->serial;
 			}
 		} request_comparitor;
 		std::shared_ptr<Canceller> canceller;
 
 		/* Image Cache handles on-disk images */
 		std::shared_ptr<ImageCache> image_cache;
+		/* Decoded images shared with the other fetchers */
+		std::shared_ptr<PixbufCache> pixbuf_cache;
 		void on_cache_result(const Glib::RefPtr<Gdk::PixbufLoader>&,
 		                     std::shared_ptr<Request>);
+		void lookup(std::shared_ptr<Request>);
+		/* Lookups made before the cache was ready */
+		std::vector<std::shared_ptr<Request> > deferred_lookups;
+		sigc::connection                      cache_ready_connection;
+		void on_cache_ready();
 
 		void start_new_download();
 		void cleanup_failed_pixmap(std::shared_ptr<Request> request, bool is_404);
@@ -96,7 +124,10 @@ namespace Horizon {
 		              >                                    request_cb_map;
 		mutable Glib::Threads::RWLock                      request_cb_rwlock;
 		std::deque<std::shared_ptr<Request> >              new_request_queue;
+		std::map<std::string, REQUEST_PRIORITY>            request_priorities;
+		REQUEST_PRIORITY                                   request_priority_fallback;
 		mutable Glib::Threads::RWLock                      request_queue_rwlock;
+		REQUEST_PRIORITY get_priority(const std::string &hash) const;
 		std::deque<std::pair<std::shared_ptr<Canceller>, std::function<void ()> > > cb_queue;
 		mutable Glib::Threads::RWLock                      cb_queue_rwlock;
 		sigc::connection                                   cb_queue_idle;
@@ -105,6 +136,8 @@ namespace Horizon {
 
 		void signal_process_cb_queue_dispatched();
 		bool process_cb_queue();
+		void queue_cb(std::shared_ptr<Canceller> canceller,
+		              std::function<void ()> cb);
 		bool add_request_cb(const std::string &request_key,
 		                    std::function<void (const Glib::RefPtr<Gdk::PixbufLoader> &)> cb);
 		bool bind_loader_to_callbacks(std::shared_ptr<Request> request,
@@ -118,6 +151,7 @@ namespace Horizon {
 		std::atomic<bool> pixbuf_updated_idle_is_connected;
 
 		bool on_pixbuf_updated();
+		void connect_loader(std::shared_ptr<Request> request);
 		void on_area_prepared(std::shared_ptr<Request> request);
 		void on_area_updated(int x, int y, int width, int height, std::shared_ptr<Request> request);
 		mutable Glib::Threads::Mutex pixbuf_update_queue_mutex;
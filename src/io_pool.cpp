@@ -0,0 +1,98 @@
+#include "io_pool.hpp"
+#include "utils.hpp"
+
+namespace Horizon {
+
+	IOPool::IOPool(const std::string &name,
+	               const unsigned int num_readers,
+	               const unsigned int num_writers)
+	{
+		for (auto &lane : lanes)
+			lane.is_stopping = false;
+
+		start_workers(name + " Read", IO_LANE_READ, num_readers);
+		start_workers(name + " Write", IO_LANE_WRITE, num_writers);
+	}
+
+	IOPool::~IOPool() {
+		stop();
+	}
+
+	void IOPool::start_workers(const std::string &name,
+	                           const IO_LANE lane,
+	                           const unsigned int num_workers) {
+		const sigc::slot<void> slot = sigc::bind(sigc::mem_fun(*this, &IOPool::worker), lane);
+
+		for (unsigned int i = 0; i < num_workers; i++) {
+			Glib::Threads::Thread *thread = nullptr;
+			int trycount = 0;
+
+			while ( thread == nullptr && trycount++ < 10 ) {
+				try {
+					thread = Horizon::create_named_thread(name, slot);
+				} catch ( Glib::Threads::ThreadError e) {
+					if (e.code() != Glib::Threads::ThreadError::AGAIN) {
+						g_error("Couldn't create IOPool thread: %s",
+						        e.what().c_str());
+					}
+				}
+			}
+
+			if (thread == nullptr)
+				g_error("Couldn't create IOPool thread, too many tries");
+
+			lanes[lane].workers.push_back(thread);
+		}
+	}
+
+	void IOPool::push(const IO_LANE lane, std::function<void ()> job) {
+		Lane &l = lanes[lane];
+		Glib::Threads::Mutex::Lock lock(l.mutex);
+		// Only happens while shutting down
+		if (G_UNLIKELY(l.is_stopping))
+			return;
+
+		l.jobs.push_back(job);
+		l.job_cond.signal();
+	}
+
+	void IOPool::stop() {
+		for (int i = 0; i < IO_LANE_COUNT; i++) {
+			Lane &lane = lanes[i];
+			Glib::Threads::Mutex::Lock lock(lane.mutex);
+			lane.is_stopping = true;
+			// Nobody is waiting on reads once we're stopping
+			if (i == IO_LANE_READ)
+				lane.jobs.clear();
+			lane.job_cond.broadcast();
+		}
+
+		for (auto &lane : lanes) {
+			for (auto thread : lane.workers)
+				thread->join();
+			lane.workers.clear();
+		}
+	}
+
+	/* Called on the lane's worker threads */
+	void IOPool::worker(const IO_LANE lane) {
+		Lane &l = lanes[lane];
+		Glib::Threads::Mutex::Lock lock(l.mutex);
+
+		while (true) {
+			while (l.jobs.empty() && !l.is_stopping)
+				l.job_cond.wait(l.mutex);
+
+			if (l.jobs.empty())
+				return;
+
+			std::function<void ()> job = std::move(l.jobs.front());
+			l.jobs.pop_front();
+
+			lock.release();
+			job();
+			job = nullptr;
+			lock.acquire();
+		}
+	}
+}
@@ -0,0 +1,54 @@
+#ifndef IO_POOL_HPP
+#define IO_POOL_HPP
+#include <array>
+#include <deque>
+#include <vector>
+#include <string>
+#include <functional>
+#include <glibmm/threads.h>
+
+namespace Horizon {
+
+	enum IO_LANE {IO_LANE_READ, IO_LANE_WRITE, IO_LANE_COUNT};
+
+	/*
+	 * Worker threads for blocking disk I/O. Reads and writes each
+	 * have a lane with workers of their own, so a large write never
+	 * holds up a read. Jobs in a lane start in the order they were
+	 * pushed.
+	 */
+	class IOPool {
+	public:
+		IOPool(const std::string &name,
+		       const unsigned int num_readers,
+		       const unsigned int num_writers);
+		~IOPool();
+		IOPool(const IOPool&) = delete;
+		IOPool& operator=(const IOPool&) = delete;
+
+		void push(const IO_LANE lane, std::function<void ()> job);
+
+		/*
+		 * Finishes the writes already pushed, drops the reads that
+		 * haven't started, and waits for the workers to exit.
+		 */
+		void stop();
+
+	private:
+		struct Lane {
+			Glib::Threads::Mutex mutex;
+			Glib::Threads::Cond  job_cond;
+			std::deque<std::function<void ()> > jobs;
+			bool                 is_stopping;
+			std::vector<Glib::Threads::Thread*> workers;
+		};
+
+		std::array<Lane, IO_LANE_COUNT> lanes;
+		void start_workers(const std::string &name,
+		                   const IO_LANE lane,
+		                   const unsigned int num_workers);
+		void worker(const IO_LANE lane);
+	};
+}
+
+#endif
@@ -1,6 +1,11 @@
 #include "manager.hpp"
 #include <iostream>
 #include <utility>
+#include <algorithm>
+#include <cstring>
+#include <giomm/file.h>
+#include <glibmm/fileutils.h>
+#include <glibmm/miscutils.h>
 #include "utils.hpp"
 
 namespace Horizon {
@@ -71,6 +76,8 @@ namespace Horizon {
 			          std::back_inserter(work_list));
 		}
 
+		restore_catalog_snapshots(work_list);
+
 		for (auto board : work_list) {
 			std::stringstream url_stream;
 			url_stream << "http://4index.gropes.us/" << board << "/threads.json";
@@ -82,6 +89,10 @@ namespace Horizon {
 					auto new_summaries = curler.pullBoard(url, board);
 
 					if (new_summaries.size() > 0) {
+						update_velocities(board, new_summaries);
+						update_watched_threads(board, new_summaries);
+						write_catalog_snapshot(board, new_summaries);
+
 						Glib::Threads::Mutex::Lock lock(catalog_mutex);
 						auto iter = catalogs.find(board);
 						if (iter != catalogs.end()) {
@@ -109,6 +120,265 @@ namespace Horizon {
 			signal_catalog_updated();
 	}
 
+	VelocityHistory::VelocityHistory() :
+		next(0),
+		count(0)
+	{
+	}
+
+	void VelocityHistory::push(const VelocitySample &sample) {
+		if (count > 0) {
+			const auto &last = samples[(next + samples.size() - 1) % samples.size()];
+			// Only samples taken after the last one, so two catalogs
+			// pulled in the same second or a clock stepped back can't
+			// leave a zero or negative interval
+			if (sample.unix_time <= last.unix_time)
+				return;
+		}
+
+		samples[next] = sample;
+		next = (next + 1) % samples.size();
+		if (count < samples.size())
+			count++;
+	}
+
+	float VelocityHistory::get_velocity() const {
+		if (count < 2)
+			return -1;
+
+		const auto &newest = samples[(next + samples.size() - 1) % samples.size()];
+		const VelocitySample *oldest = nullptr;
+		for (std::size_t i = count; i > 1; i--) {
+			const auto &sample = samples[(next + samples.size() - i) % samples.size()];
+			if (newest.unix_time - sample.unix_time <= VELOCITY_WINDOW) {
+				oldest = &sample;
+				break;
+			}
+		}
+
+		if (!oldest)
+			oldest = &samples[(next + samples.size() - 2) % samples.size()];
+
+		const gint64 seconds = newest.unix_time - oldest->unix_time;
+		const gint64 replies = std::max<gint64>(0, newest.reply_count - oldest->reply_count);
+		if (seconds <= 0)
+			return -1;
+
+		return static_cast<float>(replies) * 60.0f / static_cast<float>(seconds);
+	}
+
+	/*
+	 * Runs in a separate thread
+	 *
+	 * Records this pull of the catalog in each thread's history, hands
+	 * the resulting velocity to the summaries, and forgets threads that
+	 * have fallen off the board.
+	 */
+	void Manager::update_velocities(const std::string &board,
+	                                const std::list<Glib::RefPtr<ThreadSummary> > &summaries) {
+		const gint64 now = Glib::DateTime::create_now_utc().to_unix();
+		auto &history = catalog_history[board];
+		std::map<gint64, VelocityHistory> current;
+
+		for (auto summary : summaries) {
+			const gint64 id = summary->get_id();
+			auto iter = history.find(id);
+			VelocityHistory h = iter != history.end() ? iter->second : VelocityHistory();
+			h.push({now, summary->get_reply_count(), summary->get_image_count()});
+
+			const float velocity = h.get_velocity();
+			if (velocity >= 0)
+				summary->set_velocity(velocity);
+			current.insert(std::make_pair(id, h));
+		}
+
+		history.swap(current);
+	}
+
+	/*
+	 * Runs in a separate thread
+	 *
+	 * The catalog already knows the counts of every thread on the
+	 * board, so hand them to the threads we are watching there. The
+	 * thread checker uses them to skip pulls the catalog says would be
+	 * empty, and we wake it up early if the catalog has seen posts we
+	 * haven't.
+	 */
+	void Manager::update_watched_threads(const std::string &board,
+	                                     const std::list<Glib::RefPtr<ThreadSummary> > &summaries) {
+		const gint64 now = Glib::DateTime::create_now_utc().to_unix();
+		std::map<gint64, Glib::RefPtr<ThreadSummary> > summary_map;
+		std::vector<std::shared_ptr<Thread> > watched;
+		bool have_new_posts = false;
+
+		{
+			Glib::Threads::Mutex::Lock lock(threads_mutex);
+			for (auto pair : threads) {
+				if (pair.second->board == board && !pair.second->is_404)
+					watched.push_back(pair.second);
+			}
+		}
+
+		if (watched.size() == 0)
+			return;
+
+		for (auto summary : summaries)
+			summary_map.insert(std::make_pair(summary->get_id(), summary));
+
+		for (auto thread : watched) {
+			auto iter = summary_map.find(thread->id);
+			if (iter == summary_map.end())
+				continue;
+
+			auto summary = iter->second;
+			thread->set_catalog_velocity(summary->get_velocity());
+			thread->set_catalog_counts(now,
+			                           summary->get_reply_count(),
+			                           summary->get_image_count());
+			if (summary->get_reply_count() > thread->get_reply_count())
+				have_new_posts = true;
+		}
+
+		if (have_new_posts)
+			thread_queue_w.send();
+	}
+
+	static Glib::RefPtr<Gio::File> get_catalog_snapshot_file(const std::string &board) {
+		const std::vector<std::string> path_parts = { Glib::get_user_data_dir(),
+		                                              "horizon",
+		                                              CATALOG_SNAPSHOT_DIRNAME,
+		                                              board + CATALOG_SNAPSHOT_EXTENSION };
+		return Gio::File::create_for_path(Glib::build_filename(path_parts));
+	}
+
+	/*
+	 * Runs in a separate thread
+	 *
+	 * Boards we haven't pulled a catalog for yet are filled in from
+	 * the previous session's snapshot, so the catalog view has
+	 * something to show before the network replies. Each board is
+	 * only tried once.
+	 */
+	void Manager::restore_catalog_snapshots(const std::vector<std::string> &work_list) {
+		bool is_new = false;
+
+		for (auto board : work_list) {
+			{
+				Glib::Threads::Mutex::Lock lock(catalog_mutex);
+				if (catalogs.count(board) > 0 ||
+				    !restored_boards.insert(board).second)
+					continue;
+			}
+
+			auto summaries = read_catalog_snapshot(board);
+			if (summaries.size() > 0) {
+				Glib::Threads::Mutex::Lock lock(catalog_mutex);
+				if (catalogs.count(board) == 0) {
+					catalogs.insert(std::make_pair(board, std::move(summaries)));
+					updated_boards.insert(board);
+					is_new = true;
+				}
+			}
+		}
+
+		if (is_new)
+			signal_catalog_updated();
+	}
+
+	std::list<Glib::RefPtr<ThreadSummary> > Manager::read_catalog_snapshot(const std::string &board) const {
+		std::list<Glib::RefPtr<ThreadSummary> > summaries;
+		auto file = get_catalog_snapshot_file(board);
+		std::string contents;
+
+		try {
+			contents = Glib::file_get_contents(file->get_path());
+		} catch (Glib::FileError e) {
+			// No snapshot has been written for this board yet
+			return summaries;
+		}
+
+		guint32 version = 0;
+		if (contents.size() <= sizeof(guint32))
+			return summaries;
+		std::memcpy(&version, contents.data(), sizeof(guint32));
+		if (version != CATALOG_SNAPSHOT_VERSION) {
+			std::cerr << "Warning: Ignoring catalog snapshot for /" << board
+			          << "/ with unsupported version " << version << std::endl;
+			return summaries;
+		}
+
+		// GVariant wants its data aligned, so don't hand it the string
+		const gsize size = contents.size() - sizeof(guint32);
+		gpointer data = g_memdup(contents.data() + sizeof(guint32), size);
+		GVariant *v = g_variant_ref_sink(g_variant_new_from_data(G_VARIANT_TYPE(CATALOG_SNAPSHOT_VERSION_2_TYPE),
+		                                                         data,
+		                                                         size,
+		                                                         FALSE,
+		                                                         &g_free,
+		                                                         data));
+		GVariantIter iter;
+		gint64 id, date, images, replies;
+		const gchar *author, *teaser;
+		gboolean is_spoiler;
+		g_variant_iter_init(&iter, v);
+		while (g_variant_iter_next(&iter, "(xxxx&s&sb)", &id, &date, &images,
+		                           &replies, &author, &teaser, &is_spoiler)) {
+			GObject *csummary = G_OBJECT(g_object_new(horizon_thread_summary_get_type(),
+			                                          "date",   date,
+			                                          "i",      images,
+			                                          "r",      replies,
+			                                          "author", author,
+			                                          "teaser", teaser,
+			                                          "splr",   is_spoiler,
+			                                          NULL));
+			Glib::RefPtr<ThreadSummary> summary = Glib::wrap(HORIZON_THREAD_SUMMARY(csummary));
+			summary->set_board(board.c_str());
+			summary->set_id(id);
+			summaries.push_back(summary);
+		}
+		g_variant_unref(v);
+
+		return summaries;
+	}
+
+	void Manager::write_catalog_snapshot(const std::string &board,
+	                                     const std::list<Glib::RefPtr<ThreadSummary> > &summaries) const {
+		GVariantBuilder builder;
+		g_variant_builder_init(&builder, G_VARIANT_TYPE(CATALOG_SNAPSHOT_VERSION_2_TYPE));
+		for (auto summary : summaries) {
+			g_variant_builder_add(&builder, "(xxxxssb)",
+			                      summary->get_id(),
+			                      summary->get_unix_date(),
+			                      summary->get_image_count(),
+			                      summary->get_reply_count(),
+			                      summary->get_author().c_str(),
+			                      summary->get_teaser().c_str(),
+			                      static_cast<gboolean>(summary->is_spoiler()));
+		}
+
+		GVariant *v = g_variant_ref_sink(g_variant_builder_end(&builder));
+		const gsize data_size = g_variant_get_size(v);
+		const std::unique_ptr<guint8[]> data(new guint8[data_size]);
+		g_variant_store(v, data.get());
+		g_variant_unref(v);
+
+		auto file = get_catalog_snapshot_file(board);
+		try {
+			auto parent = file->get_parent();
+			if (!parent->query_exists())
+				parent->make_directory_with_parents();
+
+			auto ostream = file->replace();
+			gsize written = 0;
+			ostream->write_all(&CATALOG_SNAPSHOT_VERSION, sizeof(guint32), written);
+			ostream->write_all(data.get(), data_size, written);
+			ostream->close();
+		} catch (Gio::Error e) {
+			std::cerr << "Error: Unable to save the catalog snapshot for /"
+			          << board << "/: " << e.what() << std::endl;
+		}
+	}
+
 	/* Runs in a separate thread */
 	void Manager::check_threads() {
 		// Build a list of threads that are past due for an update
@@ -123,22 +393,33 @@ namespace Horizon {
 			             std::back_inserter(threads_to_check),
 			             [&now](std::pair<gint64, std::shared_ptr<Thread> > pair) {
 				             std::shared_ptr<Thread> t = pair.second;
+				             if (t->is_404)
+					             return false;
+				             if (t->catalog_shows_new_posts())
+					             return true;
 				             Glib::TimeSpan diff = std::abs(now.difference(t->last_checked));
-				             return ( diff > t->get_update_interval() &&
-				                      !t->is_404 );
+				             return diff > t->get_update_interval();
 			             });
 		}
 
 		for ( auto pair : threads_to_check ) {
 			auto thread = pair.second;
+
 			try{
-				Glib::Threads::Mutex::Lock lock(curler_mutex);
-				std::list<Glib::RefPtr<Post> > posts = curler.pullThread(thread);
-				thread->last_checked = Glib::DateTime::create_now_utc();
+				std::list<Glib::RefPtr<Post> > posts;
+				{
+					// Rendering doesn't need the Curler, so don't
+					// hold up the catalog pulls with it
+					Glib::Threads::Mutex::Lock lock(curler_mutex);
+					posts = curler.pullThread(thread);
+					thread->last_checked = Glib::DateTime::create_now_utc();
+					thread->last_pulled = thread->last_checked;
+				}
 
 				if (posts.size() > 0) {
 					auto iter = posts.rbegin();
 					thread->last_post = Glib::DateTime::create_now_utc((*iter)->get_unix_time());
+					comment_renderer.render(thread->get_changed_posts(posts));
 					thread->updatePosts(posts);
 					push_updated_thread(thread->id);
 				}
@@ -259,7 +540,16 @@ namespace Horizon {
 		kill_catalog_w.stop();
 	}
 
+	static Glib::RefPtr<Gio::File> get_render_cache_file() {
+		const std::vector<std::string> path_parts = { Glib::get_user_data_dir(),
+		                                              "horizon",
+		                                              RENDER_CACHE_FILENAME };
+		return Gio::File::create_for_path(Glib::build_filename(path_parts));
+	}
+
 	Manager::Manager() :
+		render_cache(get_render_cache_file(), RENDER_CACHE_CAPACITY),
+		comment_renderer(get_comment_renderer_worker_count(), render_cache),
 		ev_catalog_thread(nullptr),
 		ev_thread_thread(nullptr),
 		ev_catalog_loop(ev::AUTO | ev::POLL),
@@ -319,5 +609,6 @@ namespace Horizon {
 		kill_thread_w.send();
 		ev_catalog_thread->join();
 		ev_thread_thread->join();
+		render_cache.save();
 	}
 }
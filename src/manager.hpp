@@ -4,9 +4,13 @@
 #include <memory>
 #include <map>
 #include <set>
+#include <list>
+#include <vector>
+#include <array>
 #include "thread.hpp"
 #include "curler.hpp"
 #include "thread_summary.hpp"
+#include "comment_renderer.hpp"
 
 #ifdef HAVE_EV___H
 #include <ev++.h>
@@ -16,6 +20,31 @@
 
 namespace Horizon {
 
+	struct VelocitySample {
+		gint64 unix_time;
+		gint64 reply_count;
+		gint64 image_count;
+	};
+
+	/*
+	 * The last few catalog samples of one thread, kept in a ring
+	 * buffer so the velocity reflects what the thread is doing now
+	 * rather than its lifetime average.
+	 */
+	class VelocityHistory {
+	public:
+		VelocityHistory();
+
+		void push(const VelocitySample &sample);
+		// Replies per minute, or a negative value if unknown
+		float get_velocity() const;
+
+	private:
+		std::array<VelocitySample, 8> samples;
+		std::size_t next;
+		std::size_t count;
+	};
+
 	class Manager {
 	public:
 		Manager();
@@ -51,11 +80,29 @@ namespace Horizon {
 		void check_threads();
 		void check_catalogs();
 
+		/* Catalog snapshots carry the last catalog across sessions */
+		void restore_catalog_snapshots(const std::vector<std::string> &work_list);
+		std::list<Glib::RefPtr<ThreadSummary> > read_catalog_snapshot(const std::string &board) const;
+		void write_catalog_snapshot(const std::string &board,
+		                            const std::list<Glib::RefPtr<ThreadSummary> > &summaries) const;
+
 		/* Catalog variables */
 		mutable Glib::Threads::Mutex catalog_mutex;
 		std::map<std::string, std::list<Glib::RefPtr<ThreadSummary> > > catalogs;
 		std::set<std::string> boards;
 		std::set<std::string> updated_boards;
+		std::set<std::string> restored_boards;
+
+		/* Only touched on the catalog thread */
+		std::map<std::string, std::map<gint64, VelocityHistory> > catalog_history;
+		void update_velocities(const std::string &board,
+		                       const std::list<Glib::RefPtr<ThreadSummary> > &summaries);
+		void update_watched_threads(const std::string &board,
+		                            const std::list<Glib::RefPtr<ThreadSummary> > &summaries);
+
+		/* Renders new posts' comments before they are published */
+		RenderCache     render_cache;
+		CommentRenderer comment_renderer;
 
 		/* Curler is shared by both threads */
 		mutable Glib::Threads::Mutex curler_mutex;
@@ -79,4 +126,13 @@ namespace Horizon {
 		void                   on_kill_catalog_w(ev::async &w, int);
 	};
 
+	// Samples older than this don't count towards the current velocity
+	constexpr gint64 VELOCITY_WINDOW = 30 * 60;
+
+	constexpr char CATALOG_SNAPSHOT_DIRNAME[] = "catalogs";
+	constexpr char CATALOG_SNAPSHOT_EXTENSION[] = ".catalog";
+	// Version 2 has the layout of version 1 but stores decoded teasers
+	constexpr guint32 CATALOG_SNAPSHOT_VERSION = 2;
+	constexpr char CATALOG_SNAPSHOT_VERSION_2_TYPE[] = "a(xxxxssb)";
+
 }
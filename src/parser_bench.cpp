@@ -0,0 +1,129 @@
+/*
+ * Times html_to_pango, get_links and decode_html_entities_utf8 over
+ * parser_corpus.txt and reports throughput and heap allocations per
+ * post. Not run by make check; use make bench.
+ */
+#include "html_parser.hpp"
+#include "parser_corpus.hpp"
+#include "entities.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+
+#ifdef __GLIBC__
+/* Count every allocation, including libxml2's and glib's */
+extern "C" {
+	extern void *__libc_malloc(size_t size);
+	extern void *__libc_calloc(size_t nmemb, size_t size);
+	extern void *__libc_realloc(void *ptr, size_t size);
+	extern void __libc_free(void *ptr);
+}
+
+namespace {
+	std::atomic<unsigned long> allocation_count(0);
+}
+
+extern "C" {
+	void *malloc(size_t size) {
+		allocation_count.fetch_add(1, std::memory_order_relaxed);
+		return __libc_malloc(size);
+	}
+
+	void *calloc(size_t nmemb, size_t size) {
+		allocation_count.fetch_add(1, std::memory_order_relaxed);
+		return __libc_calloc(nmemb, size);
+	}
+
+	void *realloc(void *ptr, size_t size) {
+		allocation_count.fetch_add(1, std::memory_order_relaxed);
+		return __libc_realloc(ptr, size);
+	}
+
+	void free(void *ptr) {
+		__libc_free(ptr);
+	}
+}
+
+static unsigned long get_allocation_count() {
+	return allocation_count.load(std::memory_order_relaxed);
+}
+#else
+static unsigned long get_allocation_count() {
+	return 0;
+}
+#endif
+
+using namespace Horizon;
+
+namespace {
+	const int ROUNDS = 200;
+
+	template <typename F>
+	void bench(const char *name, const std::vector<std::string> &corpus,
+	           std::size_t bytes, F f) {
+		// One untimed round so the parser's contexts are warm
+		for (const std::string &html : corpus)
+			f(html);
+
+		const unsigned long allocations_before = get_allocation_count();
+		const auto start = std::chrono::steady_clock::now();
+		for (int round = 0; round < ROUNDS; round++) {
+			for (const std::string &html : corpus)
+				f(html);
+		}
+		const auto end = std::chrono::steady_clock::now();
+		const unsigned long allocations = get_allocation_count() - allocations_before;
+
+		const double seconds = std::chrono::duration<double>(end - start).count();
+		const double posts = static_cast<double>(corpus.size()) * ROUNDS;
+		const double megabytes = static_cast<double>(bytes) * ROUNDS / (1024.0 * 1024.0);
+
+		std::cout << std::left << std::setw(28) << name << std::right
+		          << std::fixed << std::setprecision(1)
+		          << std::setw(10) << megabytes / seconds << " MB/s"
+		          << std::setw(12) << posts / seconds << " posts/s";
+#ifdef __GLIBC__
+		std::cout << std::setw(10) << allocations / posts << " allocs/post";
+#endif
+		std::cout << std::endl;
+	}
+}
+
+int main(int argc, char **argv) {
+	const std::string path = corpus_path(argc, argv);
+	const std::vector<std::string> corpus = load_corpus(path);
+	if (corpus.empty()) {
+		std::cerr << "Error: Couldn't read corpus " << path << std::endl;
+		return 1;
+	}
+
+	std::size_t bytes = 0;
+	for (const std::string &html : corpus)
+		bytes += html.size();
+
+	std::cout << corpus.size() << " comments, " << bytes << " bytes, "
+	          << ROUNDS << " rounds" << std::endl;
+
+	auto parser = HtmlParser::getHtmlParser();
+	std::size_t sink = 0;
+
+	bench("html_to_pango", corpus, bytes, [&](const std::string &html) {
+			sink += parser->html_to_pango(html, CORPUS_THREAD_ID).size();
+		});
+	bench("html_to_pango_with_libxml", corpus, bytes, [&](const std::string &html) {
+			sink += parser->html_to_pango_with_libxml(html, CORPUS_THREAD_ID).size();
+		});
+	bench("get_links", corpus, bytes, [&](const std::string &html) {
+			sink += parser->get_links(html).size();
+		});
+
+	std::vector<char> dest;
+	bench("decode_html_entities_utf8", corpus, bytes, [&](const std::string &html) {
+			dest.resize(html.size() + 1);
+			sink += decode_html_entities_utf8(dest.data(), html.c_str());
+		});
+
+	return sink == 0 ? 1 : 0;
+}
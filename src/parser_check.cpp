@@ -0,0 +1,101 @@
+/*
+ * Runs every comment in parser_corpus.txt through html_to_pango and
+ * checks that its styles and links are in range, that the tokenizer
+ * agrees with libxml2, and that every quotelink get_links finds is a
+ * link. Part of make check.
+ */
+#include "html_parser.hpp"
+#include "parser_corpus.hpp"
+#include "entities.h"
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+using namespace Horizon;
+
+namespace {
+	int failures = 0;
+
+	void fail(const std::size_t line, const std::string &what) {
+		std::cerr << "FAIL: line " << line << ": " << what << std::endl;
+		failures++;
+	}
+
+	void check_entities() {
+		const struct {
+			const char *src;
+			const char *expected;
+		} cases[] = {
+			{ "&gt;&gt;123", ">>123" },
+			{ "it&#039;s", "it's" },
+			{ "&quot;&amp;&quot;", "\"&\"" },
+			{ "&#x42;&#67;", "BC" },
+			{ "caf&eacute;", "caf\xc3\xa9" },
+			{ "&notanentity;", "&notanentity;" },
+			{ "trailing &", "trailing &" },
+		};
+
+		for (const auto &c : cases) {
+			std::vector<char> dest(std::strlen(c.src) + 1);
+			decode_html_entities_utf8(dest.data(), c.src);
+			if (std::strcmp(dest.data(), c.expected) != 0) {
+				std::cerr << "FAIL: decode_html_entities_utf8(\"" << c.src
+				          << "\") gave \"" << dest.data() << "\"" << std::endl;
+				failures++;
+			}
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	const std::string path = corpus_path(argc, argv);
+	const std::vector<std::string> corpus = load_corpus(path);
+	if (corpus.empty()) {
+		std::cerr << "Error: Couldn't read corpus " << path << std::endl;
+		return 1;
+	}
+
+	auto parser = HtmlParser::getHtmlParser();
+
+	for (std::size_t i = 0; i < corpus.size(); i++) {
+		const std::string &html = corpus[i];
+		const std::size_t line = i + 1;
+
+		const auto fast = parser->html_to_pango(html, CORPUS_THREAD_ID);
+		const auto slow = parser->html_to_pango_with_libxml(html, CORPUS_THREAD_ID);
+
+		std::string error;
+		if (!segments_are_valid(fast, error))
+			fail(line, "invalid segments: " + error);
+		if (describe_segments(fast) != describe_segments(slow))
+			fail(line, "tokenizer gave \"" + describe_segments(fast) +
+			     "\", libxml2 gave \"" + describe_segments(slow) + "\"");
+
+		for (const gint64 id : parser->get_links(html)) {
+			std::stringstream target;
+			target << "#p" << id;
+			const std::string suffix = target.str();
+			bool found = false;
+			for (const auto &segment : fast) {
+				for (const auto &link : segment.links) {
+					if (link.href.size() >= suffix.size() &&
+					    link.href.compare(link.href.size() - suffix.size(),
+					                      suffix.size(), suffix) == 0)
+						found = true;
+				}
+			}
+			if (!found)
+				fail(line, "no link to " + suffix);
+		}
+
+		std::vector<char> dest(html.size() + 1);
+		const std::size_t decoded = decode_html_entities_utf8(dest.data(), html.c_str());
+		if (decoded > html.size() || std::strlen(dest.data()) != decoded)
+			fail(line, "decode_html_entities_utf8 overran");
+	}
+
+	check_entities();
+
+	std::cout << corpus.size() << " comments, " << failures << " failures" << std::endl;
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+#include "parser_corpus.hpp"
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+namespace Horizon {
+
+	std::string corpus_path(int argc, char **argv) {
+		if (argc > 1)
+			return std::string(argv[1]);
+
+		const char *srcdir = std::getenv("srcdir");
+		if (srcdir)
+			return std::string(srcdir) + "/parser_corpus.txt";
+
+		return std::string("parser_corpus.txt");
+	}
+
+	std::vector<std::string> load_corpus(const std::string &path) {
+		std::vector<std::string> corpus;
+		std::ifstream in(path.c_str());
+		std::string line;
+
+		while (std::getline(in, line)) {
+			if (!line.empty())
+				corpus.push_back(line);
+		}
+
+		return corpus;
+	}
+
+	namespace {
+		bool is_boundary(const std::string &text, const guint32 offset) {
+			return offset == text.size() ||
+				(offset < text.size() &&
+				 (static_cast<unsigned char>(text[offset]) & 0xC0) != 0x80);
+		}
+
+		bool range_is_valid(const std::string &text,
+		                    const guint32 start,
+		                    const guint32 end) {
+			return start < end && end <= text.size() &&
+				is_boundary(text, start) && is_boundary(text, end);
+		}
+	}
+
+	bool segments_are_valid(const std::list<CommentSegment> &segments,
+	                        std::string &error) {
+		bool is_code = false;
+
+		for (const CommentSegment &segment : segments) {
+			const std::string &text = segment.text.raw();
+			if (!g_utf8_validate(text.data(), text.size(), nullptr)) {
+				error = "invalid UTF-8: " + text;
+				return false;
+			}
+			if (is_code && (!segment.styles.empty() || !segment.links.empty())) {
+				error = "styled code: " + text;
+				return false;
+			}
+			for (const auto &style : segment.styles) {
+				if (!range_is_valid(text, style.start, style.end)) {
+					error = "bad style range: " + text;
+					return false;
+				}
+			}
+			for (const auto &link : segment.links) {
+				if (!range_is_valid(text, link.start, link.end)) {
+					error = "bad link range: " + text;
+					return false;
+				}
+			}
+			is_code = !is_code;
+		}
+
+		return true;
+	}
+
+	std::string describe_segments(const std::list<CommentSegment> &segments) {
+		std::stringstream out;
+
+		for (const CommentSegment &segment : segments) {
+			out << segment.text.raw() << "\x1e";
+			for (const auto &style : segment.styles)
+				out << style.start << "-" << style.end << ":" << style.style << " ";
+			out << "\x1e";
+			for (const auto &link : segment.links)
+				out << link.start << "-" << link.end << ":" << link.href << " ";
+			out << "\x1f";
+		}
+
+		return out.str();
+	}
+}
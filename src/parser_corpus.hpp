@@ -0,0 +1,38 @@
+#ifndef PARSER_CORPUS_HPP
+#define PARSER_CORPUS_HPP
+#include <list>
+#include <string>
+#include <vector>
+#include <glibmm/ustring.h>
+#include "html_parser.hpp"
+
+namespace Horizon {
+
+	/*
+	 * Shared by parser_check, parser_bench and parser_fuzz. The corpus
+	 * is one comment per line, as 4chan's JSON API sends them.
+	 */
+
+	/* argv[1] if given, else parser_corpus.txt in $srcdir or . */
+	std::string corpus_path(int argc, char **argv);
+
+	/* Empty if the file can't be read */
+	std::vector<std::string> load_corpus(const std::string &path);
+
+	/*
+	 * html_to_pango output alternates markup and code, starting with
+	 * markup. Returns false and sets error if a style or link doesn't
+	 * cover whole characters of its segment's text, or a code segment
+	 * has any.
+	 */
+	bool segments_are_valid(const std::list<CommentSegment> &segments,
+	                        std::string &error);
+
+	/* Everything but the attributes, which come from the styles */
+	std::string describe_segments(const std::list<CommentSegment> &segments);
+
+	/* The thread every corpus comment is parsed as belonging to */
+	constexpr gint64 CORPUS_THREAD_ID = 51971506;
+}
+
+#endif
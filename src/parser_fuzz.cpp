@@ -0,0 +1,128 @@
+/*
+ * Fuzz target for the comment parser. Whenever the tokenizer accepts
+ * an input its output has to match libxml2's, with every style and
+ * link in range; any input at all must parse without crashing.
+ *
+ * Built normally this runs the corpus plus a fixed set of mutations
+ * of it as part of make check. For libFuzzer, build with
+ *   CXX=clang++ CXXFLAGS="-g -fsanitize=fuzzer,address -DHORIZON_LIBFUZZER"
+ * and run ./parser_fuzz with a copy of the corpus split one comment
+ * per file.
+ */
+#include "html_parser.hpp"
+#include "parser_corpus.hpp"
+#include "entities.h"
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+using namespace Horizon;
+
+namespace {
+	void check(const std::string &html) {
+		auto parser = HtmlParser::getHtmlParser();
+		const auto segments = parser->html_to_pango(html, CORPUS_THREAD_ID);
+		parser->get_links(html);
+
+		std::vector<char> dest(html.size() + 1);
+		decode_html_entities_utf8(dest.data(), html.c_str());
+
+		ParseContext context;
+		context.reset(CORPUS_THREAD_ID);
+		if (!context.tokenize(html))
+			return;
+
+		const auto slow = parser->html_to_pango_with_libxml(html, CORPUS_THREAD_ID);
+		if (describe_segments(segments) != describe_segments(slow)) {
+			std::cerr << "Error: Tokenizer and libxml2 disagree on \""
+			          << html << "\"" << std::endl;
+			std::abort();
+		}
+
+		std::string error;
+		if (!segments_are_valid(segments, error)) {
+			std::cerr << "Error: Invalid segments for \"" << html << "\": "
+			          << error << std::endl;
+			std::abort();
+		}
+	}
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	// Comments never contain NULs; decode_html_entities_utf8 stops at one
+	std::string html(reinterpret_cast<const char*>(data), size);
+	html = html.substr(0, html.find('\0'));
+	check(html);
+	return 0;
+}
+
+#ifndef HORIZON_LIBFUZZER
+namespace {
+	const int ITERATIONS = 20000;
+
+	/* Fragments of the markup 4chan sends, spliced into corpus entries */
+	const char *const FRAGMENTS[] = {
+		"<br>", "<wbr>", "<s>", "</s>", "<em>", "</em>", "</a>", "</span>",
+		"<span class=\"quote\">", "<span class=\"deadlink\">",
+		"<a href=\"#p51971506\" class=\"quotelink\">",
+		"<a href=\"/g/thread/1#p2\" class=\"quotelink\">",
+		"<a href=\"\"\" class=\"quotelink\">",
+		"<pre class=\"prettyprint\">", "</pre>",
+		"&gt;", "&lt;", "&amp;", "&#039;", "&quot;", "&#x1F600;", "&eacute;",
+		"&", ";", "<", ">", "\"", "'", "\t", "\n", " ", "\xc2\x85", "\xe2\x80\xa8",
+	};
+	const std::size_t FRAGMENT_COUNT = sizeof(FRAGMENTS) / sizeof(FRAGMENTS[0]);
+
+	std::string mutate(std::string html, std::mt19937 &rng) {
+		const int edits = 1 + static_cast<int>(rng() % 4);
+		for (int i = 0; i < edits; i++) {
+			const std::size_t pos = html.empty() ? 0 : rng() % (html.size() + 1);
+			switch (rng() % 4) {
+			case 0:
+				html.insert(pos, FRAGMENTS[rng() % FRAGMENT_COUNT]);
+				break;
+			case 1:
+				if (pos < html.size())
+					html.erase(pos, 1 + rng() % 8);
+				break;
+			case 2:
+				if (pos < html.size())
+					html[pos] = static_cast<char>(rng() % 256);
+				break;
+			default:
+				if (!html.empty()) {
+					const std::size_t from = rng() % html.size();
+					html.insert(pos, html.substr(from, 1 + rng() % 16));
+				}
+				break;
+			}
+		}
+		return html;
+	}
+}
+
+int main(int argc, char **argv) {
+	const std::string path = corpus_path(argc, argv);
+	const std::vector<std::string> corpus = load_corpus(path);
+	if (corpus.empty()) {
+		std::cerr << "Error: Couldn't read corpus " << path << std::endl;
+		return 1;
+	}
+
+	for (const std::string &html : corpus)
+		check(html);
+
+	// Fixed seed so failures reproduce
+	std::mt19937 rng(4);
+	for (int i = 0; i < ITERATIONS; i++) {
+		const std::string &seed = corpus[rng() % corpus.size()];
+		const std::string html = mutate(seed, rng);
+		LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t*>(html.data()),
+		                       html.size());
+	}
+
+	std::cout << corpus.size() + ITERATIONS << " inputs" << std::endl;
+	return 0;
+}
+#endif
@@ -0,0 +1,94 @@
+#include "pixbuf_cache.hpp"
+#include <gdkmm/pixbufanimation.h>
+
+namespace Horizon {
+
+	PixbufCache::PixbufCache(const gsize budget_) :
+		budget(budget_),
+		size(0)
+	{
+	}
+
+	std::string PixbufCache::make_key(const std::string &md5, const bool is_thumb) {
+		std::string key(is_thumb ? "T_" : "I_");
+		key.append(md5);
+		return key;
+	}
+
+	/*
+	 * Animations aren't counted since we can't see their frames
+	 * without walking them; they return 0 and are never kept.
+	 */
+	gsize PixbufCache::get_cost(const Glib::RefPtr<Gdk::PixbufLoader> &loader) {
+		auto animation = loader->get_animation();
+		if (animation && !animation->is_static_image())
+			return 0;
+
+		auto pixbuf = loader->get_pixbuf();
+		if (!pixbuf)
+			return 0;
+
+		return static_cast<gsize>(pixbuf->get_rowstride()) *
+			static_cast<gsize>(pixbuf->get_height());
+	}
+
+	/*
+	 * Called from Glib main thread
+	 */
+	Glib::RefPtr<Gdk::PixbufLoader> PixbufCache::get(const std::string &md5,
+	                                                 const bool is_thumb) {
+		Glib::Threads::Mutex::Lock lock(mutex);
+		auto iter = entries.find(make_key(md5, is_thumb));
+		if (iter == entries.end())
+			return Glib::RefPtr<Gdk::PixbufLoader>();
+
+		lru.splice(lru.begin(), lru, iter->second);
+		return iter->second->loader;
+	}
+
+	/*
+	 * Called on ImageCache thread, its read lanes or an ImageFetcher ev_thread
+	 */
+	void PixbufCache::insert(const std::string &md5,
+	                         const bool is_thumb,
+	                         const Glib::RefPtr<Gdk::PixbufLoader> &loader) {
+		if (!loader)
+			return;
+
+		const gsize bytes = get_cost(loader);
+		// A single full size image shouldn't push out everything else
+		if (bytes == 0 || bytes > budget / 4)
+			return;
+
+		std::string key = make_key(md5, is_thumb);
+		Glib::Threads::Mutex::Lock lock(mutex);
+		auto iter = entries.find(key);
+		if (iter != entries.end()) {
+			size -= iter->second->bytes;
+			lru.erase(iter->second);
+			entries.erase(iter);
+		}
+
+		lru.push_front({key, loader, bytes});
+		entries.insert({std::move(key), lru.begin()});
+		size += bytes;
+		trim();
+	}
+
+	gsize PixbufCache::get_size() const {
+		Glib::Threads::Mutex::Lock lock(mutex);
+		return size;
+	}
+
+	/*
+	 * mutex must be held
+	 */
+	void PixbufCache::trim() {
+		while (size > budget && !lru.empty()) {
+			const Entry &entry = lru.back();
+			size -= entry.bytes;
+			entries.erase(entry.key);
+			lru.pop_back();
+		}
+	}
+}
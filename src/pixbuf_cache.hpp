@@ -0,0 +1,59 @@
+#ifndef PIXBUF_CACHE_HPP
+#define PIXBUF_CACHE_HPP
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <glib.h>
+#include <glibmm/threads.h>
+#include <gdkmm/pixbufloader.h>
+
+namespace Horizon {
+
+	/* Bytes of decoded pixels kept in memory */
+	constexpr gsize PIXBUF_CACHE_BUDGET = 64 * 1024 * 1024;
+
+	/*
+	 * Keeps the most recently decoded images in memory so the
+	 * catalog, posts, tab images and notifications showing the
+	 * same md5 don't each read and decode it again. Entries are
+	 * closed loaders, keyed by md5 and whether it is the
+	 * thumbnail, and are dropped least recently used first once
+	 * their pixels pass the byte budget.
+	 */
+	class PixbufCache {
+	public:
+		PixbufCache(const gsize budget);
+		~PixbufCache() = default;
+		PixbufCache(const PixbufCache&) = delete;
+		PixbufCache& operator=(const PixbufCache&) = delete;
+
+		/* Returns an empty RefPtr on a miss */
+		Glib::RefPtr<Gdk::PixbufLoader> get(const std::string &md5,
+		                                    const bool is_thumb);
+		void insert(const std::string &md5,
+		            const bool is_thumb,
+		            const Glib::RefPtr<Gdk::PixbufLoader> &loader);
+
+		gsize get_size() const;
+
+	private:
+		struct Entry {
+			std::string                     key;
+			Glib::RefPtr<Gdk::PixbufLoader> loader;
+			gsize                           bytes;
+		};
+
+		static std::string make_key(const std::string &md5, const bool is_thumb);
+		static gsize get_cost(const Glib::RefPtr<Gdk::PixbufLoader> &loader);
+		void trim();
+
+		mutable Glib::Threads::Mutex mutex;
+		/* Most recently used at the front */
+		std::list<Entry> lru;
+		std::unordered_map<std::string, std::list<Entry>::iterator> entries;
+		const gsize budget;
+		gsize size;
+	};
+}
+
+#endif
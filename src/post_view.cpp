@@ -14,11 +14,11 @@
 #include <gtkmm/cssprovider.h>
 #include <gtkmm/comboboxtext.h>
 #include "html_parser.hpp"
+#include "code_block.hpp"
 #include "horizon_image.hpp"
 #include <giomm/unixoutputstream.h>
 #include <glibmm/fileutils.h>
 #include <glibmm/spawn.h>
-#include <gtksourceviewmm.h>
 
 namespace Horizon {
 
@@ -161,8 +161,6 @@ namespace Horizon {
 		comment->set_justify(Gtk::JUSTIFY_LEFT);
 		comment->set_line_wrap(true);
 		comment->set_line_wrap_mode(Pango::WRAP_WORD_CHAR);
-		comment->set_track_visited_links(true);
-		comment->signal_activate_link().connect(sigc::mem_fun(*this, &PostView::on_activate_link), false);
 
 
 		content_grid->set_name("commentgrid");
@@ -208,25 +206,55 @@ namespace Horizon {
 			return Glib::RefPtr<Gdk::Pixbuf>();
 	}
 
-	static Glib::ustring str_squish(const Glib::ustring& in) {
-		if (in.size() > 0) {
-			auto start =   std::begin(in);
-			auto end   = --std::end  (in);
-			while ( start != in.end()   && *start == '\n' )
-				++start;
-			while ( end   != in.begin() && *end   == '\n' )
-				--end;
-			if ( start <= end ) {
-				return Glib::ustring(start, ++end);
-			}
+	/*
+	 * The label gets text and attributes, never markup, so it has no
+	 * links of its own. Clicks are looked up in the segment's links
+	 * instead.
+	 */
+	void PostView::set_label_comment(Gtk::Label &label,
+	                                 const CommentSegment &segment) {
+		Pango::AttrList attributes(segment.attributes);
+		label.set_text(segment.text);
+		label.set_attributes(attributes);
+
+		if (!segment.links.empty()) {
+			auto slot = sigc::bind(sigc::mem_fun(*this, &PostView::on_comment_button_release),
+			                       &label, segment.links);
+			label.signal_button_release_event().connect(slot, false);
 		}
-
-		return Glib::ustring();
 	}
 
-	static void on_language_changed(Glib::RefPtr<Gsv::Buffer>& buf, const Gtk::ComboBoxText* cbox) {
-		auto const lmgr = Gsv::LanguageManager::get_default();
-		buf->set_language(lmgr->get_language(cbox->get_active_text()));
+	bool PostView::on_comment_button_release(GdkEventButton *event,
+	                                         Gtk::Label *label,
+	                                         const std::vector<CommentLink> &links) {
+		int start, end;
+		if (event->button != 1 || label->get_selection_bounds(start, end))
+			return false;
+
+		// Event coordinates are relative to the allocation, the
+		// layout offsets to the label's window
+		int layout_x, layout_y;
+		label->get_layout_offsets(layout_x, layout_y);
+		const Gtk::Allocation allocation = label->get_allocation();
+		const int x = static_cast<int>(event->x) - (layout_x - allocation.get_x());
+		const int y = static_cast<int>(event->y) - (layout_y - allocation.get_y());
+
+		int index, trailing;
+		if (!label->get_layout()->xy_to_index(x * PANGO_SCALE, y * PANGO_SCALE,
+		                                      index, trailing))
+			return false;
+
+		for (const auto &link : links) {
+			if (static_cast<guint32>(index) >= link.start &&
+			    static_cast<guint32>(index) < link.end) {
+				on_activate_link(link.href);
+				break;
+			}
+		}
+
+		// The label still sees the release, so its selection
+		// handling isn't left half done
+		return false;
 	}
 
 	void PostView::launch_editor(const Glib::ustring& code_text) {
@@ -243,60 +271,41 @@ namespace Horizon {
 	}
 
 	void PostView::set_comment_grid() {
-		auto parser  = HtmlParser::getHtmlParser();
-		auto strings = parser->html_to_pango(post->get_comment(), post->get_thread_id());
-		comment->set_markup(str_squish(strings.front()));
-		if (strings.size() > 1) {
+		std::list<CommentSegment> parsed;
+		auto rendered = post->get_rendered_comment();
+		if (!rendered) {
+			auto parser = HtmlParser::getHtmlParser();
+			parsed = parser->html_to_pango(post->get_comment(), post->get_thread_id());
+		}
+		const std::list<CommentSegment> &segments = rendered ? rendered->segments : parsed;
+
+		set_label_comment(*comment, segments.front());
+		if (segments.size() > 1) {
+			std::size_t i = 1;
 			bool is_code = true;
-			auto iter = ++strings.begin();
-			for ( ; iter != strings.end(); ++iter) {
+			auto iter = ++segments.begin();
+			for ( ; iter != segments.end(); ++iter) {
 				if (is_code) {
-					auto const code_text = str_squish(*iter);
-					auto const lmgr      = Gsv::LanguageManager::get_default();	
-					auto const ids       = lmgr->get_language_ids();
-					auto buf    = Gsv::Buffer::create();
-					auto grid   = Gtk::manage(new Gtk::Grid());
-					auto cbox   = Gtk::manage(new Gtk::ComboBoxText(true));
-					auto btn    = Gtk::manage(new Gtk::Button("Launch Editor"));
-					auto label  = Gtk::manage(new Gtk::Label(""));
-					auto sview  = Gtk::manage(new Gsv::View(buf));
-					label->set_hexpand(true);
-					btn  ->set_hexpand(false);
-					cbox ->set_hexpand(false);
-					buf->set_text(code_text);
-					buf->set_language(lmgr->get_language("c"));
-					typedef void (Gtk::ComboBoxText::*MethodType)(const Glib::ustring&);
-					std::for_each(std::begin(ids),
-					              std::end(ids),
-					              std::bind(MethodType(&Gtk::ComboBoxText::append),
-					                        cbox, std::placeholders::_1));
-					cbox->set_active_text("c");
-					auto on_language = sigc::bind(sigc::ptr_fun(&on_language_changed),
-					                              buf, cbox);
-					auto on_launch   = sigc::bind(sigc::mem_fun(*this, &PostView::launch_editor),
-					                              code_text);
-					btn ->signal_clicked().connect(on_launch);
-					cbox->signal_changed().connect(on_language);
-
-					grid->attach(*cbox,  0, 0, 1, 1);
-					grid->attach(*label, 1, 0, 1, 1);
-					grid->attach(*btn,   2, 0, 1, 1);
-					grid->attach(*sview, 0, 1, 3, 1);
-					viewport_grid->add(*grid);
+					auto const on_launch = sigc::mem_fun(*this, &PostView::launch_editor);
+					auto const language  = rendered && i < rendered->languages.size() ?
+						rendered->languages[i] : guess_code_language(iter->text.raw());
+					auto block = Gtk::manage(new CodeBlock(iter->text,
+					                                       language,
+					                                       on_launch));
+					viewport_grid->add(*block);
 				} else {
 					Gtk::Label* c = Gtk::manage(new Gtk::Label());
-					c->set_markup(str_squish(*iter));
+					set_label_comment(*c, *iter);
 					c->set_selectable(true);
 					c->set_valign(Gtk::ALIGN_START);
 					c->set_halign(Gtk::ALIGN_START);
 					c->set_justify(Gtk::JUSTIFY_LEFT);
 					c->set_line_wrap(true);
 					c->set_line_wrap_mode(Pango::WRAP_WORD_CHAR);
-					c->set_track_visited_links(true);
-					c->signal_activate_link().connect(sigc::mem_fun(*this, &PostView::on_activate_link), false);
 					viewport_grid->add(*c);
 				}
 				is_code = !is_code;
+				i++;
 			}
 		}
 	}
@@ -37,6 +37,11 @@ namespace Horizon {
 		PostView& operator=(const PostView&) = delete;
 
 		void set_comment_grid();
+		void set_label_comment(Gtk::Label &label,
+		                       const CommentSegment &segment);
+		bool on_comment_button_release(GdkEventButton *event,
+		                               Gtk::Label *label,
+		                               const std::vector<CommentLink> &links);
 
 		Glib::RefPtr<Post> post;
 		Gtk::Grid* post_info_grid;
@@ -0,0 +1,67 @@
+#include "quote_graph.hpp"
+#include <algorithm>
+
+namespace Horizon {
+
+	guint32 QuoteGraph::get_index(const gint64 id) {
+		auto iter = index.find(id);
+		if (iter != index.end())
+			return iter->second;
+
+		const guint32 i = static_cast<guint32>(ids.size());
+		index.insert(std::make_pair(id, i));
+		ids.push_back(id);
+		is_added.push_back(false);
+		quotes.push_back(std::vector<guint32>());
+		replies.push_back(std::vector<guint32>());
+
+		return i;
+	}
+
+	void QuoteGraph::add_post(const gint64 id, const std::list<gint64> &links) {
+		const guint32 from = get_index(id);
+		if (is_added[from])
+			return;
+		is_added[from] = true;
+
+		for (auto link : links) {
+			const guint32 to = get_index(link);
+			auto &forward = quotes[from];
+			if (std::find(forward.begin(), forward.end(), to) != forward.end())
+				continue;
+
+			forward.push_back(to);
+			replies[to].push_back(from);
+		}
+	}
+
+	bool QuoteGraph::has_post(const gint64 id) const {
+		auto iter = index.find(id);
+		return iter != index.end() && is_added[iter->second];
+	}
+
+	std::vector<gint64> QuoteGraph::to_ids(const std::vector<guint32> &indices) const {
+		std::vector<gint64> out;
+		out.reserve(indices.size());
+		for (auto i : indices)
+			out.push_back(ids[i]);
+
+		return out;
+	}
+
+	std::vector<gint64> QuoteGraph::get_quotes(const gint64 id) const {
+		auto iter = index.find(id);
+		if (iter == index.end())
+			return std::vector<gint64>();
+
+		return to_ids(quotes[iter->second]);
+	}
+
+	std::vector<gint64> QuoteGraph::get_replies(const gint64 id) const {
+		auto iter = index.find(id);
+		if (iter == index.end())
+			return std::vector<gint64>();
+
+		return to_ids(replies[iter->second]);
+	}
+}
@@ -0,0 +1,44 @@
+#ifndef QUOTE_GRAPH_HPP
+#define QUOTE_GRAPH_HPP
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <glib.h>
+
+namespace Horizon {
+
+	/*
+	 * Who quotes whom within a thread. Posts get a dense index the
+	 * first time they are seen, either as a post or as the target of
+	 * a quote, and both directions are kept as arrays of indices.
+	 *
+	 * Not thread safe; Thread guards it.
+	 */
+	class QuoteGraph {
+	public:
+		QuoteGraph() = default;
+		QuoteGraph(const QuoteGraph&) = delete;
+		QuoteGraph& operator=(const QuoteGraph&) = delete;
+
+		/* Records a post's quotes. Repeated calls for a post do nothing */
+		void add_post(const gint64 id, const std::list<gint64> &quotes);
+		bool has_post(const gint64 id) const;
+
+		/* The posts id quotes, in the order it first quotes them */
+		std::vector<gint64> get_quotes(const gint64 id) const;
+		/* The posts quoting id, in the order they were added */
+		std::vector<gint64> get_replies(const gint64 id) const;
+
+	private:
+		std::unordered_map<gint64, guint32> index;
+		std::vector<gint64> ids;
+		std::vector<bool> is_added;
+		std::vector<std::vector<guint32> > quotes;
+		std::vector<std::vector<guint32> > replies;
+
+		guint32 get_index(const gint64 id);
+		std::vector<gint64> to_ids(const std::vector<guint32> &indices) const;
+	};
+}
+
+#endif
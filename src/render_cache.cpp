@@ -0,0 +1,230 @@
+#include "render_cache.hpp"
+#include <iostream>
+#include <cstring>
+#include <tuple>
+#include <vector>
+#include <glibmm/fileutils.h>
+
+namespace Horizon {
+
+	bool RenderKey::operator<(const RenderKey &other) const {
+		return std::tie(post, comment_hash, board) <
+			std::tie(other.post, other.comment_hash, other.board);
+	}
+
+	/* 64 bit FNV-1a */
+	guint64 hash_comment(const std::string &comment) {
+		guint64 hash = G_GUINT64_CONSTANT(14695981039346656037);
+
+		for (const char c : comment) {
+			hash ^= static_cast<guint8>(c);
+			hash *= G_GUINT64_CONSTANT(1099511628211);
+		}
+
+		return hash;
+	}
+
+	RenderKey make_render_key(const Glib::RefPtr<Post> &post) {
+		return RenderKey{post->get_board(),
+				post->get_id(),
+				hash_comment(post->get_comment())};
+	}
+
+	RenderCache::RenderCache(const Glib::RefPtr<Gio::File> &cache_file_in,
+	                         const std::size_t capacity_in) :
+		cache_file(cache_file_in),
+		capacity(capacity_in),
+		is_loaded(false),
+		is_dirty(false)
+	{
+	}
+
+	std::shared_ptr<const RenderedComment> RenderCache::lookup(const Glib::RefPtr<Post> &post) {
+		const RenderKey key = make_render_key(post);
+		Glib::Threads::Mutex::Lock lock(mutex);
+		if (!is_loaded)
+			load();
+
+		auto iter = index.find(key);
+		if (iter == index.end())
+			return std::shared_ptr<const RenderedComment>();
+
+		lru.splice(lru.begin(), lru, iter->second);
+		return iter->second->second;
+	}
+
+	void RenderCache::insert(const Glib::RefPtr<Post> &post,
+	                         const std::shared_ptr<const RenderedComment> &rendered) {
+		const RenderKey key = make_render_key(post);
+		Glib::Threads::Mutex::Lock lock(mutex);
+		if (!is_loaded)
+			load();
+
+		insert_locked(key, rendered);
+		is_dirty = true;
+	}
+
+	void RenderCache::insert_locked(const RenderKey &key,
+	                                const std::shared_ptr<const RenderedComment> &rendered) {
+		auto iter = index.find(key);
+		if (iter != index.end()) {
+			iter->second->second = rendered;
+			lru.splice(lru.begin(), lru, iter->second);
+			return;
+		}
+
+		lru.push_front(std::make_pair(key, rendered));
+		index.insert(std::make_pair(key, lru.begin()));
+
+		while (lru.size() > capacity) {
+			index.erase(lru.back().first);
+			lru.pop_back();
+		}
+	}
+
+	/* Called with the mutex held */
+	void RenderCache::load() {
+		is_loaded = true;
+
+		std::string contents;
+		try {
+			contents = Glib::file_get_contents(cache_file->get_path());
+		} catch (Glib::FileError e) {
+			return;
+		}
+
+		guint32 version = 0;
+		if (contents.size() <= sizeof(guint32))
+			return;
+		std::memcpy(&version, contents.data(), sizeof(guint32));
+		if (version != RENDER_CACHE_VERSION) {
+			std::cerr << "Warning: Ignoring render cache with unsupported version "
+			          << version << std::endl;
+			return;
+		}
+
+		const gsize size = contents.size() - sizeof(guint32);
+		gpointer data = g_memdup(contents.data() + sizeof(guint32), size);
+		GVariant *v = g_variant_ref_sink(g_variant_new_from_data(G_VARIANT_TYPE(RENDER_CACHE_VERSION_1_TYPE),
+		                                                         data,
+		                                                         size,
+		                                                         FALSE,
+		                                                         &g_free,
+		                                                         data));
+
+		// Saved most recent first, so insert from the back
+		const gsize n = g_variant_n_children(v);
+		for (gsize i = n; i > 0; i--) {
+			GVariant *child = g_variant_get_child_value(v, i - 1);
+			const gchar *board;
+			gint64 post;
+			guint64 comment_hash;
+			GVariantIter *segment_iter, *link_iter;
+			g_variant_get(child, "(&sxta(sa(uuy)a(uus))ax)", &board, &post, &comment_hash,
+			              &segment_iter, &link_iter);
+
+			auto rendered = std::make_shared<RenderedComment>();
+			bool is_valid = true;
+			const gchar *text;
+			GVariantIter *style_iter, *href_iter;
+			while (g_variant_iter_next(segment_iter, "(&sa(uuy)a(uus))", &text,
+			                           &style_iter, &href_iter)) {
+				CommentSegment segment;
+				segment.text = text;
+				const gsize text_size = segment.text.bytes();
+
+				guint32 start, end;
+				guchar style;
+				while (g_variant_iter_next(style_iter, "(uuy)", &start, &end, &style)) {
+					is_valid = is_valid && start < end && end <= text_size &&
+						style <= COMMENT_STYLE_ITALIC;
+					segment.styles.push_back(CommentStyle{start, end,
+								static_cast<COMMENT_STYLE>(style)});
+				}
+				const gchar *href;
+				while (g_variant_iter_next(href_iter, "(uu&s)", &start, &end, &href)) {
+					is_valid = is_valid && start < end && end <= text_size;
+					segment.links.push_back(CommentLink{start, end, href});
+				}
+				g_variant_iter_free(style_iter);
+				g_variant_iter_free(href_iter);
+
+				if (is_valid)
+					segment.attributes = make_comment_attributes(segment.styles);
+				rendered->segments.push_back(std::move(segment));
+			}
+			gint64 link;
+			while (g_variant_iter_next(link_iter, "x", &link))
+				rendered->links.push_back(link);
+			g_variant_iter_free(segment_iter);
+			g_variant_iter_free(link_iter);
+
+			if (is_valid && rendered->segments.size() > 0)
+				insert_locked(RenderKey{board, post, comment_hash}, rendered);
+			g_variant_unref(child);
+		}
+
+		g_variant_unref(v);
+	}
+
+	void RenderCache::save() {
+		GVariantBuilder builder;
+		{
+			Glib::Threads::Mutex::Lock lock(mutex);
+			if (!is_dirty)
+				return;
+
+			g_variant_builder_init(&builder, G_VARIANT_TYPE(RENDER_CACHE_VERSION_1_TYPE));
+			for (const auto &entry : lru) {
+				GVariantBuilder segments, links;
+				g_variant_builder_init(&segments, G_VARIANT_TYPE("a(sa(uuy)a(uus))"));
+				g_variant_builder_init(&links, G_VARIANT_TYPE("ax"));
+				for (const auto &segment : entry.second->segments) {
+					GVariantBuilder styles, hrefs;
+					g_variant_builder_init(&styles, G_VARIANT_TYPE("a(uuy)"));
+					g_variant_builder_init(&hrefs, G_VARIANT_TYPE("a(uus)"));
+					for (const auto &style : segment.styles)
+						g_variant_builder_add(&styles, "(uuy)", style.start, style.end,
+						                      static_cast<guchar>(style.style));
+					for (const auto &link : segment.links)
+						g_variant_builder_add(&hrefs, "(uus)", link.start, link.end,
+						                      link.href.c_str());
+
+					g_variant_builder_add(&segments, "(sa(uuy)a(uus))",
+					                      segment.text.c_str(), &styles, &hrefs);
+				}
+				for (const auto link : entry.second->links)
+					g_variant_builder_add(&links, "x", link);
+
+				g_variant_builder_add(&builder, "(sxta(sa(uuy)a(uus))ax)",
+				                      entry.first.board.c_str(),
+				                      entry.first.post,
+				                      entry.first.comment_hash,
+				                      &segments,
+				                      &links);
+			}
+			is_dirty = false;
+		}
+
+		GVariant *v = g_variant_ref_sink(g_variant_builder_end(&builder));
+		const gsize data_size = g_variant_get_size(v);
+		const std::unique_ptr<guint8[]> data(new guint8[data_size]);
+		g_variant_store(v, data.get());
+		g_variant_unref(v);
+
+		try {
+			auto parent = cache_file->get_parent();
+			if (!parent->query_exists())
+				parent->make_directory_with_parents();
+
+			auto ostream = cache_file->replace();
+			gsize written = 0;
+			ostream->write_all(&RENDER_CACHE_VERSION, sizeof(guint32), written);
+			ostream->write_all(data.get(), data_size, written);
+			ostream->close();
+		} catch (Gio::Error e) {
+			std::cerr << "Error: Unable to save the render cache: "
+			          << e.what() << std::endl;
+		}
+	}
+}
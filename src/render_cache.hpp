@@ -0,0 +1,68 @@
+#ifndef RENDER_CACHE_HPP
+#define RENDER_CACHE_HPP
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <glibmm/threads.h>
+#include <giomm/file.h>
+#include "thread.hpp"
+
+namespace Horizon {
+
+	struct RenderKey {
+		std::string board;
+		gint64 post;
+		guint64 comment_hash;
+
+		bool operator<(const RenderKey &other) const;
+	};
+
+	/*
+	 * Least recently used cache of rendered comments, kept on disk
+	 * between sessions. A post is only a hit if its comment hashes to
+	 * the same value, so edited or replaced posts are rendered again.
+	 */
+	class RenderCache {
+	public:
+		RenderCache(const Glib::RefPtr<Gio::File> &cache_file,
+		            const std::size_t capacity);
+		~RenderCache() = default;
+		RenderCache(const RenderCache&) = delete;
+		RenderCache& operator=(const RenderCache&) = delete;
+
+		std::shared_ptr<const RenderedComment> lookup(const Glib::RefPtr<Post> &post);
+		void insert(const Glib::RefPtr<Post> &post,
+		            const std::shared_ptr<const RenderedComment> &rendered);
+
+		void save();
+
+	private:
+		typedef std::pair<RenderKey, std::shared_ptr<const RenderedComment> > Entry;
+
+		Glib::RefPtr<Gio::File> cache_file;
+		const std::size_t capacity;
+
+		mutable Glib::Threads::Mutex mutex;
+		// Most recently used at the front
+		std::list<Entry> lru;
+		std::map<RenderKey, std::list<Entry>::iterator> index;
+		bool is_loaded;
+		bool is_dirty;
+
+		void load();
+		void insert_locked(const RenderKey &key,
+		                   const std::shared_ptr<const RenderedComment> &rendered);
+	};
+
+	RenderKey make_render_key(const Glib::RefPtr<Post> &post);
+	guint64 hash_comment(const std::string &comment);
+
+	constexpr char RENDER_CACHE_FILENAME[] = "horizon-render-cache.dat";
+	constexpr guint32 RENDER_CACHE_VERSION = 1;
+	// Segments are their text, (start, end, style) and (start, end, href)
+	constexpr char RENDER_CACHE_VERSION_1_TYPE[] = "a(sxta(sa(uuy)a(uus))ax)";
+	constexpr std::size_t RENDER_CACHE_CAPACITY = 50000;
+}
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef SMALL_SET_HPP
+#define SMALL_SET_HPP
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+#include <glib.h>
+
+namespace Horizon {
+
+	/*
+	 * A sorted set of plain values which keeps up to N of them
+	 * inline and only allocates past that. Image cache entries
+	 * nearly always have one board, one poster and a date or two,
+	 * where a std::set would allocate a node for each.
+	 */
+	template <class T, guint16 N>
+	class SmallSet {
+		static_assert(std::is_trivial<T>::value, "SmallSet only holds plain values");
+		static_assert(N > 0, "SmallSet needs inline storage");
+	public:
+		typedef const T* const_iterator;
+
+		SmallSet() : count(0), capacity(N) {}
+		~SmallSet() {
+			if (is_on_heap())
+				g_free(storage.heap);
+		}
+		SmallSet(const SmallSet&) = delete;
+		SmallSet& operator=(const SmallSet&) = delete;
+
+		const_iterator begin() const { return data(); }
+		const_iterator end()   const { return data() + count; }
+		gsize          size()  const { return count; }
+		bool           empty() const { return count == 0; }
+
+		/* Returns whether value was new */
+		bool insert(const T value) {
+			T *items = data();
+			T *pos = std::lower_bound(items, items + count, value);
+			if (pos != items + count && *pos == value)
+				return false;
+
+			const gsize index = pos - items;
+			if (count == capacity) {
+				grow();
+				items = data();
+			}
+			std::memmove(items + index + 1, items + index,
+			             (count - index) * sizeof(T));
+			items[index] = value;
+			count++;
+			return true;
+		}
+
+		template <class InputIt>
+		void insert(InputIt first, InputIt last) {
+			for (; first != last; ++first)
+				insert(*first);
+		}
+
+	private:
+		bool is_on_heap() const { return capacity > N; }
+		T*       data()       { return is_on_heap() ? storage.heap : storage.items; }
+		const T* data() const { return is_on_heap() ? storage.heap : storage.items; }
+
+		void grow() {
+			if (capacity > G_MAXUINT16 / 2)
+				g_error("SmallSet can't hold more than %u values", G_MAXUINT16);
+
+			const guint16 new_capacity = capacity * 2;
+			T *heap = g_new(T, new_capacity);
+			std::memcpy(heap, data(), count * sizeof(T));
+			if (is_on_heap())
+				g_free(storage.heap);
+			storage.heap = heap;
+			capacity = new_capacity;
+		}
+
+		union {
+			T  items[N];
+			T *heap;
+		} storage;
+		guint16 count;
+		guint16 capacity;
+	};
+}
+
+#endif
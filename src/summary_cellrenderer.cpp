@@ -1,6 +1,8 @@
 #include "summary_cellrenderer.hpp"
 #include <iostream>
-#include <iomanip>
+#include <algorithm>
+#include <gtkmm/stylecontext.h>
+#include <glibmm/markup.h>
 
 namespace Horizon {
 	
@@ -12,7 +14,6 @@ namespace Horizon {
 		thumb_natural_width(0)
 	{
 		property_threads_.get_proxy().signal_changed().connect(sigc::mem_fun(*this, &SummaryCellRenderer::on_changed));
-		cr_text.set_alignment(.5, .5);
 	}
 
 	SummaryCellRenderer::~SummaryCellRenderer() {
@@ -27,28 +28,85 @@ namespace Horizon {
 			if ( ts->get_thumb_pixbuf() ) {
 				thumb_natural_height = ts->get_thumb_pixbuf()->get_height();
 				thumb_natural_width = ts->get_thumb_pixbuf()->get_width();
+			} else {
+				thumb_natural_height = 0;
+				thumb_natural_width = 0;
 			}
+		}
+	}
 
-			auto ppm = static_cast<float>(ts->get_reply_count()) /
-				static_cast<float>(Glib::DateTime::
-				                   create_now_utc().to_unix() -
-				                   ts->get_unix_date());
-
-			ppm = ppm * static_cast<float>(60);
+	void SummaryCellRenderer::clear_layout_cache() {
+		layout_cache.clear();
+	}
 
-			std::stringstream s;
-			s << "R: <b>" << ts->get_reply_count() << "</b> I: <b>"
-			  << ts->get_image_count() << "</b> PPM: <b>" 
-			  << std::fixed << std::setprecision(2) << ppm << "</b>\n"
-			  << ts->get_teaser();
+	void SummaryCellRenderer::forget_layout(const gint64 id) {
+		layout_cache.erase(id);
+	}
 
+	/*
+	 * Tree views measure a cell at the column's width but render it in
+	 * a slightly narrower area, so the layout is keyed by the width the
+	 * text wraps at, which both agree on.
+	 */
+	static int get_wrap_width(const int width) {
+		return std::max(1, std::min(SUMMARY_WRAP_WIDTH,
+		                            width - 2 * SUMMARY_TEXT_PAD));
+	}
 
-			cr_text.property_markup().set_value(s.str());
-			cr_text.property_wrap_mode().set_value(Pango::WRAP_WORD_CHAR);
-			cr_text.property_wrap_width().set_value(250);
-			cr_text.property_alignment().set_value(Pango::ALIGN_CENTER);
-			cr_text.property_background().set_value("#8C92AC");
+	/*
+	 * Returns the cached layout for the current summary, laying it out
+	 * again only if the counts, the velocity or the wrap width have
+	 * changed since.
+	 */
+	const SummaryLayout& SummaryCellRenderer::get_layout(Gtk::Widget &widget, int width) const {
+		auto ts = property_threads_.get_value();
+		const int wrap_width = get_wrap_width(width);
+		const gint64 id = ts->get_id();
+		const gint64 reply_count = ts->get_reply_count();
+		const gint64 image_count = ts->get_image_count();
+		const float velocity = ts->get_velocity();
+
+		auto iter = layout_cache.find(id);
+		if (iter != layout_cache.end() &&
+		    iter->second.reply_count == reply_count &&
+		    iter->second.image_count == image_count &&
+		    iter->second.velocity == velocity &&
+		    iter->second.wrap_width == wrap_width) {
+			return iter->second;
 		}
+		// Threads that leave the catalog are forgotten, but not every
+		// model change tells us, so don't let the cache grow unbounded
+		if (iter == layout_cache.end() &&
+		    layout_cache.size() >= SUMMARY_LAYOUT_CACHE_MAX)
+			layout_cache.clear();
+
+		gchar *header = g_strdup_printf("R: <b>%" G_GINT64_FORMAT "</b> I: <b>%"
+		                                G_GINT64_FORMAT "</b> PPM: <b>%.2f</b>\n",
+		                                reply_count, image_count, velocity);
+		std::string markup(header);
+		g_free(header);
+		markup.append(Glib::Markup::escape_text(ts->get_teaser()));
+
+		SummaryLayout entry;
+		entry.reply_count = reply_count;
+		entry.image_count = image_count;
+		entry.velocity = velocity;
+		entry.wrap_width = wrap_width;
+		entry.layout = widget.create_pango_layout("");
+		entry.layout->set_markup(markup);
+		entry.layout->set_wrap(Pango::WRAP_WORD_CHAR);
+		entry.layout->set_width(wrap_width * Pango::SCALE);
+		entry.layout->set_alignment(Pango::ALIGN_CENTER);
+
+		int layout_width, layout_height;
+		entry.layout->get_pixel_size(layout_width, layout_height);
+		entry.height = layout_height + 2 * SUMMARY_TEXT_PAD;
+
+		auto pair = layout_cache.insert(std::make_pair(id, entry));
+		if (!pair.second)
+			pair.first->second = entry;
+
+		return pair.first->second;
 	}
 
 	Glib::PropertyProxy< Glib::RefPtr<ThreadSummary> > SummaryCellRenderer::property_threads() {
@@ -62,58 +120,36 @@ namespace Horizon {
 	void SummaryCellRenderer::get_preferred_width_vfunc (Gtk::Widget& widget,
 	                                                     int& minimum_width,
 	                                                     int& natural_width) const {
-		Gtk::CellRenderer::get_preferred_width_vfunc(widget, minimum_width, natural_width);
-		
-		int text_min_width = minimum_width, text_nat_width = natural_width;
-
-		cr_text.get_preferred_width(widget, text_min_width, text_nat_width);
-
-		minimum_width = 260;// std::max(thumb_natural_width, text_min_width);
-		natural_width = 260;//std::max(thumb_natural_width, text_nat_width);
+		minimum_width = SUMMARY_CELL_WIDTH;
+		natural_width = SUMMARY_CELL_WIDTH;
 	}
 
 	void SummaryCellRenderer::get_preferred_height_for_width_vfunc (Gtk::Widget& widget,
 	                                                                int width,
 	                                                                int& minimum_height,
 	                                                                int& natural_height) const {
-		Gtk::CellRenderer::get_preferred_height_for_width_vfunc(widget, width, minimum_height, natural_height);
-
-		int text_min_height = minimum_height, text_nat_height = natural_height;
+		int text_height = 0;
 
-		cr_text.get_preferred_height_for_width(widget, 260, text_min_height, text_nat_height);
+		if (property_threads_.get_value())
+			text_height = get_layout(widget, width).height;
 
-		minimum_height = thumb_natural_height + text_min_height + 5;
-		natural_height = thumb_natural_height + text_nat_height + 5;
+		minimum_height = thumb_natural_height + text_height + SUMMARY_THUMB_SPACING;
+		natural_height = minimum_height;
 	}
 
 	void SummaryCellRenderer::get_preferred_height_vfunc (Gtk::Widget& widget,
 	                                                      int& minimum_height,
 	                                                      int& natural_height) const {
-		Gtk::CellRenderer::get_preferred_height_vfunc(widget, minimum_height, natural_height);
-
-		int text_min_height = minimum_height, text_nat_height = natural_height;
-
-		cr_text.get_preferred_height(widget, text_min_height, text_nat_height);
-
-		minimum_height = thumb_natural_height + text_min_height + 5;
-		natural_height = thumb_natural_height + text_nat_height + 5;
+		get_preferred_height_for_width_vfunc(widget, SUMMARY_CELL_WIDTH,
+		                                     minimum_height, natural_height);
 	}
 
 	void SummaryCellRenderer::get_preferred_width_for_height_vfunc (Gtk::Widget& widget,
 	                                                                int height,
 	                                                                int& minimum_width,
 	                                                                int& natural_width) const {
-		Gtk::CellRenderer::get_preferred_width_for_height_vfunc(widget, height, minimum_width, natural_width);
-
-		//int text_min_width = minimum_width, text_nat_width = natural_width;
-
-		//cr_text.get_preferred_width_for_height(widget,
-		//                                     height - thumb_natural_height - 5,
-		//                                     text_min_width,
-		//                                     text_nat_width);
-
-		minimum_width = 260; //+= std::max(thumb_natural_width, text_min_width);
-		natural_width = 260;//+= std::max(thumb_natural_width, text_nat_width);
+		minimum_width = SUMMARY_CELL_WIDTH;
+		natural_width = SUMMARY_CELL_WIDTH;
 	}
 
 	void SummaryCellRenderer::render_vfunc (const ::Cairo::RefPtr< ::Cairo::Context >& cr,
@@ -122,14 +158,36 @@ namespace Horizon {
 	                                        const Gdk::Rectangle& cell_area,
 	                                        Gtk::CellRendererState flags) {
 		Gtk::CellRenderer::render_vfunc(cr, widget, background_area, cell_area, flags);
-		
+
+		if ((flags & Gtk::CELL_RENDERER_SELECTED) == 0) {
+			cr->save();
+			cr->rectangle(background_area.get_x(), background_area.get_y(),
+			              background_area.get_width(), background_area.get_height());
+			cr->set_source_rgb(0x8C / 255.0, 0x92 / 255.0, 0xAC / 255.0);
+			cr->fill();
+			cr->restore();
+		}
+
+		if (property_threads_.get_value()) {
+			const SummaryLayout &entry = get_layout(widget, cell_area.get_width());
+			int layout_width, layout_height;
+			entry.layout->get_pixel_size(layout_width, layout_height);
+
+			const int text_x = cell_area.get_x() +
+				std::max(0, (cell_area.get_width() - layout_width) / 2);
+			const int text_y = cell_area.get_y() + thumb_natural_height +
+				SUMMARY_THUMB_SPACING + SUMMARY_TEXT_PAD;
+
+			auto context = widget.get_style_context();
+			context->context_save();
+			if (flags & Gtk::CELL_RENDERER_SELECTED)
+				context->set_state(context->get_state() | Gtk::STATE_FLAG_SELECTED);
+			context->render_layout(cr, text_x, text_y, entry.layout);
+			context->context_restore();
+		}
+
 		Gdk::Rectangle thumb_rec(cell_area.get_x(), cell_area.get_y(),
 		                         cell_area.get_width(), thumb_natural_height);
-		Gdk::Rectangle text_rec(cell_area.get_x(),
-		                        cell_area.get_y() + thumb_natural_height + 5,
-		                        cell_area.get_width(), cell_area.get_height() - thumb_natural_height - 5);
-		
-		cr_text.render(cr, widget, background_area, text_rec, flags);
 		cr_thumb.render(cr, widget, background_area, thumb_rec, flags);
 	}
 	
@@ -4,11 +4,27 @@
 #include <gtkmm/cellrenderertext.h>
 #include <gtkmm/cellrendererpixbuf.h>
 #include <glibmm/property.h>
+#include <pangomm/layout.h>
+#include <map>
 #include "thread_summary.hpp"
 
 
 namespace Horizon {
 
+	/*
+	 * A wrapped teaser is expensive to measure, so keep the layout
+	 * around until the thread's counts, velocity or the width it wraps
+	 * at change.
+	 */
+	struct SummaryLayout {
+		gint64 reply_count;
+		gint64 image_count;
+		float velocity;
+		int wrap_width;
+		int height;
+		Glib::RefPtr<Pango::Layout> layout;
+	};
+
 	class SummaryCellRenderer : public Gtk::CellRenderer {
 	public:
 		virtual ~SummaryCellRenderer();
@@ -18,6 +34,10 @@ namespace Horizon {
 
 	    bool is_activatable() const { return true; };
 
+		void clear_layout_cache();
+		/* Drops the layout of a thread that left the catalog */
+		void forget_layout(const gint64 id);
+
 	protected:
 		Glib::Property< Glib::RefPtr<ThreadSummary> > property_threads_;
 
@@ -53,10 +73,18 @@ namespace Horizon {
 		int thumb_natural_width;
 
 		Gtk::CellRendererPixbuf cr_thumb;
-		Gtk::CellRendererText cr_text;
-		
+
+		mutable std::map<gint64, SummaryLayout> layout_cache;
+		const SummaryLayout& get_layout(Gtk::Widget &widget, int width) const;
 	};
 
+	constexpr int SUMMARY_CELL_WIDTH = 260;
+	constexpr int SUMMARY_WRAP_WIDTH = 250;
+	constexpr int SUMMARY_TEXT_PAD = 2;
+	constexpr int SUMMARY_THUMB_SPACING = 5;
+	// A board's catalog is at most 150 threads
+	constexpr gsize SUMMARY_LAYOUT_CACHE_MAX = 512;
+
 }
 
 
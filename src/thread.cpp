@@ -1,5 +1,7 @@
 #include "thread.hpp"
+#include "html_parser.hpp"
 #include <cstdlib>
+#include <algorithm>
 #include <iostream>
 #include <iomanip>
 #include <chrono>
@@ -72,6 +74,14 @@ namespace Horizon {
 		horizon_post_set_thread_id(gobj(), id);
 	}
 
+	void Post::set_rendered_comment(const std::shared_ptr<const RenderedComment> &rendered) {
+		rendered_comment = rendered;
+	}
+
+	std::shared_ptr<const RenderedComment> Post::get_rendered_comment() const {
+		return rendered_comment;
+	}
+
 	bool Post::is_same_post(const Glib::RefPtr<Post> &post) const {
 		return horizon_post_is_same_post(gobj(), post->gobj());
 	}
@@ -284,10 +294,15 @@ namespace Horizon {
 	Thread::Thread(std::string url) :
 		full_url(url),
 		last_checked(Glib::DateTime::create_now_utc(0)),
+		last_pulled(Glib::DateTime::create_now_utc(0)),
 		last_post(Glib::DateTime::create_now_utc(0)),
 		images(0),
 		is_404(false),
-		update_interval_iter(UPDATE_INTERVALS.begin())
+		update_interval_iter(UPDATE_INTERVALS.begin()),
+		catalog_velocity(0),
+		catalog_unix_time(0),
+		catalog_reply_count(0),
+		catalog_image_count(0)
 	{
 		auto const hash_pos  = url.rfind("#");
 		auto const res_pos   = url.rfind("/res/");
@@ -309,6 +324,7 @@ namespace Horizon {
 				posts.insert({post->get_id(), post});
 				if (post->has_image())
 					images++;
+				add_to_graph(post);
 			} else {
 				if ( conflicting_post->second->is_not_same_post(post) ) {
 					// The new post has updated metadata (sticky, file
@@ -320,6 +336,52 @@ namespace Horizon {
 		}
 	}
 
+	/* Called with posts_mutex held */
+	void Thread::add_to_graph(const Glib::RefPtr<Post> &post) {
+		auto rendered = post->get_rendered_comment();
+		std::list<gint64> links;
+		if (rendered) {
+			links = rendered->links;
+		} else {
+			links = HtmlParser::getHtmlParser()->get_links(post->get_comment());
+		}
+
+		// Only keep quotes of posts in this thread, and never the post itself
+		for (auto iter = links.begin(); iter != links.end(); ) {
+			if (*iter == post->get_id() || posts.count(*iter) == 0)
+				iter = links.erase(iter);
+			else
+				iter++;
+		}
+
+		Glib::Mutex::Lock lock(graph_mutex);
+		quote_graph.add_post(post->get_id(), links);
+	}
+
+	std::vector<gint64> Thread::get_quotes(const gint64 id) const {
+		Glib::Mutex::Lock lock(graph_mutex);
+		return quote_graph.get_quotes(id);
+	}
+
+	std::vector<gint64> Thread::get_replies(const gint64 id) const {
+		Glib::Mutex::Lock lock(graph_mutex);
+		return quote_graph.get_replies(id);
+	}
+
+	std::list<Glib::RefPtr<Post> > Thread::get_changed_posts(const std::list<Glib::RefPtr<Post> > &new_posts) const {
+		Glib::Mutex::Lock lock(posts_mutex);
+		std::list<Glib::RefPtr<Post> > changed;
+
+		for ( auto post : new_posts ) {
+			auto conflicting_post = posts.find(post->get_id());
+			if ( conflicting_post == posts.end() ||
+			     conflicting_post->second->is_not_same_post(post) )
+				changed.push_back(post);
+		}
+
+		return changed;
+	}
+
 	bool Thread::for_each_post(std::function<bool(const Glib::RefPtr<Post>&) > func) {
 		Glib::Mutex::Lock lock(posts_mutex);
 		bool ret = false;
@@ -336,6 +398,15 @@ namespace Horizon {
 		return images;
 	}
 
+	gint64 Thread::get_reply_count() const {
+		Glib::Mutex::Lock lock(posts_mutex);
+
+		if (posts.size() == 0)
+			return 0;
+
+		return static_cast<gint64>(posts.size()) - 1;
+	}
+
 	const Glib::RefPtr<Post> Thread::get_first_post() const {
 		Glib::Mutex::Lock lock(posts_mutex);
 		
@@ -346,8 +417,54 @@ namespace Horizon {
 			return Glib::RefPtr<Post>();
 	}
 
+	/*
+	 * The backoff only knows whether our own pulls found anything. If
+	 * the catalog says the thread is moving, don't wait much longer
+	 * than it takes for a new post to show up.
+	 */
 	Glib::TimeSpan Thread::get_update_interval() const { 
-		return (*update_interval_iter) * 1000 * 1000;
+		const Glib::TimeSpan backoff = (*update_interval_iter) * 1000 * 1000;
+		const float velocity = catalog_velocity.load();
+
+		if (velocity > 0) {
+			const Glib::TimeSpan expected = static_cast<Glib::TimeSpan>(60.0f * 1000 * 1000 / velocity);
+			return std::min(backoff, std::max(MIN_UPDATE_INTERVAL, expected));
+		}
+
+		return backoff;
+	}
+
+	void Thread::set_catalog_velocity(const float velocity) {
+		catalog_velocity.store(velocity);
+	}
+
+	/* Called on the catalog thread */
+	void Thread::set_catalog_counts(const gint64 unix_time,
+	                                const gint64 reply_count,
+	                                const gint64 image_count) {
+		Glib::Mutex::Lock lock(catalog_counts_mutex);
+		catalog_unix_time = unix_time;
+		catalog_reply_count = reply_count;
+		catalog_image_count = image_count;
+	}
+
+	/* Called on the thread curler's thread */
+	bool Thread::catalog_shows_new_posts() const {
+		gint64 unix_time, reply_count, image_count;
+		{
+			Glib::Mutex::Lock lock(catalog_counts_mutex);
+			unix_time = catalog_unix_time;
+			reply_count = catalog_reply_count;
+			image_count = catalog_image_count;
+		}
+
+		if (unix_time <= last_pulled.to_unix())
+			return false;
+
+		// Deleted posts can leave the catalog behind us, so only
+		// more is news.
+		return reply_count > get_reply_count() ||
+		       image_count > static_cast<gint64>(images);
 	}
 
 	bool Thread::should_notify() const {
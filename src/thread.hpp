@@ -2,6 +2,7 @@
 #define NATIVECHAN_THREAD_HPP
 #include <string>
 #include <list>
+#include <vector>
 #include <glibmm/datetime.h>
 #include <glib.h>
 #include <glibmm/thread.h>
@@ -9,10 +10,14 @@
 #include <map>
 #include <random>
 #include <functional>
+#include <atomic>
 #include <glibmm/dispatcher.h>
 #include <glibmm/object.h>
 #include <glibmm/private/object_p.h>
 #include <glibmm/class.h>
+#include <glibmm/ustring.h>
+#include "html_parser.hpp"
+#include "quote_graph.hpp"
 
 extern "C" {
 #include "horizon_post.h"
@@ -21,6 +26,17 @@ extern "C" {
 namespace Horizon {
 	class Post;
 
+	/* A comment already run through the HtmlParser */
+	struct RenderedComment {
+		std::list<CommentSegment> segments;
+		/*
+		 * One per segment, what guess_code_language picked for code
+		 * segments and empty for the rest.
+		 */
+		std::vector<std::string> languages;
+		std::list<gint64> links;
+	};
+
 	class Post_Class : public Glib::Class {
 	public:
 		typedef Post CppObjectType;
@@ -103,6 +119,16 @@ namespace Horizon {
 		std::string get_board() const;
 		void set_thread_id(const gint64 id);
 		gint64 get_thread_id() const;
+
+		/*
+		 * Set by the CommentRenderer before the post is handed to
+		 * the main thread. Empty if the post skipped it.
+		 */
+		void set_rendered_comment(const std::shared_ptr<const RenderedComment> &rendered);
+		std::shared_ptr<const RenderedComment> get_rendered_comment() const;
+
+	private:
+		std::shared_ptr<const RenderedComment> rendered_comment;
 	};
 
 	class Thread {
@@ -115,18 +141,37 @@ namespace Horizon {
 		std::string api_url;
 		std::string board;
 		Glib::DateTime last_checked;
+		Glib::DateTime last_pulled;
 		Glib::DateTime last_post;
 		gsize images;
 		bool is_404;
 		Glib::TimeSpan get_update_interval() const;
 		void update_notify(bool was_new);
 
+		/* Replies per minute as last seen in the catalog */
+		void set_catalog_velocity(const float velocity);
+
+		/* Counts for this thread from the catalog pulled at unix_time */
+		void set_catalog_counts(const gint64 unix_time,
+		                        const gint64 reply_count,
+		                        const gint64 image_count);
+		/*
+		 * Whether the catalog, pulled after our own last pull, knows
+		 * of posts we don't. Only ever used to pull early: the
+		 * catalog comes from a mirror that can lag behind, and our
+		 * own count keeps posts deleted upstream, so agreeing counts
+		 * never delay a scheduled pull.
+		 */
+		bool catalog_shows_new_posts() const;
+
 		Glib::Dispatcher signal_updated_interval;
 
 		/* Appends to the list any new posts
 		   Marks changed posts (Thread lock/file deletion) as changed.
 		 */
 		void updatePosts(const std::list<Glib::RefPtr<Post> > &new_posts);
+		/* The posts updatePosts would add or replace */
+		std::list<Glib::RefPtr<Post> > get_changed_posts(const std::list<Glib::RefPtr<Post> > &new_posts) const;
 		const Glib::RefPtr<Post> get_first_post() const;
 
 		/*
@@ -138,6 +183,12 @@ namespace Horizon {
 		bool should_notify() const;
 		
 		gsize get_image_count() const;
+		gint64 get_reply_count() const;
+
+		/* Posts in this thread that id quotes, built as posts arrive */
+		std::vector<gint64> get_quotes(const gint64 id) const;
+		/* Posts in this thread quoting id */
+		std::vector<gint64> get_replies(const gint64 id) const;
 
 	protected:
 		Thread(std::string url);
@@ -150,7 +201,17 @@ namespace Horizon {
 		mutable Glib::Mutex posts_mutex;
 		std::map<gint64, Glib::RefPtr<Post> > posts;
 
+		mutable Glib::Mutex graph_mutex;
+		QuoteGraph quote_graph;
+		void add_to_graph(const Glib::RefPtr<Post> &post);
+
 		std::vector<Glib::TimeSpan>::const_iterator update_interval_iter;
+		std::atomic<float> catalog_velocity;
+
+		mutable Glib::Mutex catalog_counts_mutex;
+		gint64 catalog_unix_time;
+		gint64 catalog_reply_count;
+		gint64 catalog_image_count;
 		//Glib::TimeSpan update_interval;
 		//std::default_random_engine generator;
 		//std::uniform_int_distribution<Glib::TimeSpan> random_int;
@@ -28,12 +28,14 @@ namespace Horizon {
 
 	ThreadSummary::ThreadSummary(HorizonThreadSummary* castitem) :
 		Glib::Object((GObject*) castitem),
-		canceller(new Canceller())
+		canceller(new Canceller()),
+		velocity(-1)
 	{}
 
 	ThreadSummary::ThreadSummary(const Glib::ConstructParams &params) :
 		Glib::Object(params),
-		canceller(new Canceller())
+		canceller(new Canceller()),
+		velocity(-1)
 	{}
 
 	ThreadSummary::CppClassType ThreadSummary::thread_summary_class_;
@@ -86,6 +88,37 @@ namespace Horizon {
 		return s.str();
 	}
 
+	const std::string ThreadSummary::get_author() const {
+		const gchar *author = horizon_thread_summary_get_author(gobj());
+		std::stringstream s;
+
+		if (author)
+			s << static_cast<const char *>(author);
+
+		return s.str();
+	}
+
+	bool ThreadSummary::is_spoiler() const {
+		return static_cast<bool>(horizon_thread_summary_is_spoiler(gobj()));
+	}
+
+	float ThreadSummary::get_velocity() const {
+		if (velocity >= 0)
+			return velocity;
+
+		const gint64 age = Glib::DateTime::create_now_utc().to_unix() - get_unix_date();
+		if (age <= 0)
+			velocity = 0;
+		else
+			velocity = static_cast<float>(get_reply_count()) * 60.0f / static_cast<float>(age);
+
+		return velocity;
+	}
+
+	void ThreadSummary::set_velocity(const float v) {
+		velocity = v;
+	}
+
 	gint64 ThreadSummary::get_image_count() const {
 		return horizon_thread_summary_get_image_count(gobj());
 	}
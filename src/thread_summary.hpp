@@ -65,15 +65,26 @@ namespace Horizon {
 		void set_board(const gchar* board);
 		const std::string get_url() const;
 		const std::string get_teaser() const;
+		const std::string get_author() const;
+		bool is_spoiler() const;
 		const std::string get_hash() const;
 		Glib::RefPtr<Gdk::Pixbuf> get_thumb_pixbuf();
 		gint64 get_unix_date() const;
 
+		/*
+		 * Replies per minute. Set by the Manager from its catalog
+		 * history; until it has one, this is the lifetime average
+		 * as of the first time it was asked for.
+		 */
+		float get_velocity() const;
+		void set_velocity(const float velocity);
+
 		Glib::RefPtr<Horizon::Post> get_proxy_post() const;
 
 	private:
 		void on_thumb(const Glib::RefPtr<Gdk::PixbufLoader> &loader);
 		std::shared_ptr<Canceller> canceller;
+		mutable float velocity;
 	};
 }
 
@@ -10,7 +10,6 @@
 #include <giomm/file.h>
 #include <gtkmm/stock.h>
 #include "thread.hpp"
-#include "html_parser.hpp"
 #include "horizon_image.hpp"
 #include "image_fetcher.hpp"
 
@@ -122,17 +121,16 @@ namespace Horizon {
 		prev_value = 0.;
 
 		show_all();
-		
-		auto slot = sigc::mem_fun(*this, &ThreadView::refresh_tab_text);
-		tab_updates = Glib::signal_timeout().connect_seconds(sigc::bind_return(slot, true), 10);
+
+		// Catch up on ticks missed while the tab was scrolled away
+		tab_window->signal_map().connect( sigc::mem_fun(*this, &ThreadView::refresh_tab_text) );
 	}
 
 	ThreadView::~ThreadView() {
 		canceller->cancel();
+		for (auto hash : pinned_hashes)
+			image_cache->unpin(hash);
 		hide();
-		if (tab_updates.connected())
-			tab_updates.disconnect();
-
 		if (unshown_view_idle.connected())
 			unshown_view_idle.disconnect();
 
@@ -168,7 +166,6 @@ namespace Horizon {
 
 	bool ThreadView::refresh_post(const Glib::RefPtr<Post> &post) {
 		bool was_new = false;
-		auto parser = HtmlParser::getHtmlParser();
 
 		if ( post_map.count(post->get_id()) > 0 ) {
 			// This post is already in the view
@@ -179,6 +176,9 @@ namespace Horizon {
 			}
 		} else {
 			// This is a new post
+			if (post->has_image() && pinned_hashes.insert(post->get_hash()).second)
+				image_cache->pin(post->get_hash());
+
 			PostView *pv = Gtk::manage(new PostView(post, ifetcher));
 			post_map.insert({post->get_id(), pv});
 			pv->signal_activate_link.connect(sigc::mem_fun(*this, &ThreadView::on_activate_link));
@@ -188,14 +188,20 @@ namespace Horizon {
 
 			unshown_views.push_back(pv);
 
-			auto links = parser->get_links(post->get_comment());
-			for ( auto link : links ) {
+			for ( auto link : thread->get_quotes(post->get_id()) ) {
 				auto iter = post_map.find(link);
 				if (iter != post_map.end()) {
 					iter->second->add_linkback(post->get_id());
 				}
 			}
 
+			// Replies shown before this post couldn't link back to it
+			for ( auto reply : thread->get_replies(post->get_id()) ) {
+				if (post_map.count(reply) > 0) {
+					pv->add_linkback(reply);
+				}
+			}
+
 			if (expand_button->get_active())
 				pv->set_image_state(Image::EXPAND);
 		}
@@ -354,7 +360,16 @@ namespace Horizon {
 			                               lastpost);
 		}
 
-		tab_label->set_markup(label);
+		// Most ticks don't change what the tab says
+		if (label != tab_markup) {
+			tab_markup = label;
+			tab_label->set_markup(label);
+		}
+	}
+
+	void ThreadView::on_tab_tick() {
+		if (tab_window->get_mapped())
+			refresh_tab_text();
 	}
 
 	/*
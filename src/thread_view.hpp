@@ -3,6 +3,7 @@
 
 #include <memory>
 #include <map>
+#include <set>
 #include <giomm/settings.h>
 #include <gtkmm/grid.h>
 #include <gtkmm/viewport.h>
@@ -34,6 +35,8 @@ namespace Horizon {
 		sigc::signal<void, gint64> signal_closed;
 
 		Gtk::Widget* get_tab_label() {return tab_window;};
+		/* Called by the Application's ticker. Only touches tabs on screen */
+		void on_tab_tick();
 
 	private:
 		std::shared_ptr<Thread>       thread;
@@ -52,7 +55,7 @@ namespace Horizon {
 		Gtk::Grid                    *tab_label_grid;
 		Gtk::Image                   *tab_image;
 		bool                          fetching_image;
-		sigc::connection              tab_updates;
+		Glib::ustring                 tab_markup;
 
 		std::deque<PostView*>         unshown_views;
 		bool on_unshown_views();
@@ -62,6 +65,8 @@ namespace Horizon {
 		Glib::RefPtr<Gio::Settings>   settings;
 		std::shared_ptr<Notifier>     notifier;
 		std::shared_ptr<ImageCache>   image_cache;
+		// Images of the thread are kept in the cache while it is open
+		std::set<std::string>         pinned_hashes;
 		std::shared_ptr<ImageFetcher> ifetcher;
 		Glib::RefPtr<Gtk::Application> gapplication;
 		std::shared_ptr<Canceller>    canceller;